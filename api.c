@@ -9,8 +9,53 @@
 #include "kernel.h"
 
 #include "api.h"
+#include "input.h"
 #include "output.h"
+#include "expression.h"
+#include "frame.h"
 #include "narrative.h"
+#include "variables.h"
+#include "memory.h"
+
+/*---------------------------------------------------------------------------
+	cn_init
+---------------------------------------------------------------------------*/
+int
+cn_init( void )
+/*
+	sets up the engine's context, base stack and value accounts. Must be
+	called once before any other cn_ function - returns 0 if the engine
+	was already initialized.
+*/
+{
+	if ( CN.context != NULL ) return 0;
+
+	_context *context = (_context *) calloc( 1, sizeof(_context) );
+	CN.context = context;
+
+	CN.this = newEntity( NULL, NULL, NULL );
+	CN.nil = newEntity( NULL, NULL, NULL );
+	CN.nil->sub[0] = CN.nil;
+	CN.nil->sub[1] = CN.nil;
+	CN.nil->sub[2] = CN.nil;
+	CN.nil->state = 1;	// always on
+
+	StackVA *stack = (StackVA *) calloc( 1, sizeof(StackVA) );
+	set_this_variable( &stack->variables, CN.this );
+
+	registerByName( &CN.VB, "name", NULL );
+	registerByName( &CN.VB, "hcn", NULL );
+	registerByName( &CN.VB, "url", NULL );
+	registerByName( &CN.VB, "narratives", NULL );
+
+	context->control.mode = ExecutionMode;
+	context->control.stack = newItem( stack );
+	context->control.prompt = 1;
+	context->hcn.state = "";
+	context->frame.cap = FRAME_CAP;
+	context->memory.keep = COMPACT_KEEP;
+	return 1;
+}
 
 /*---------------------------------------------------------------------------
 	cn_entity
@@ -37,11 +82,12 @@ cn_name( Entity *e )
 Entity *
 cn_new( char *name )
 {
+	drainCursors( CN.context );
 	Entity *e = newEntity( NULL, NULL, NULL );
 	cn_va_set_value( e, "name", name );
 	registerByName( &CN.registry, name, e );
 	addItem( &CN.DB, e );
-	addItem( &CN.context->frame.log.entities.instantiated, e );
+	logEntity( InstantiateEvent, e, CN.context );
 	return e;
 }
 
@@ -216,32 +262,169 @@ cn_is_active( Entity *e )
 Entity *
 cn_instantiate( Entity *source, Entity *medium, Entity *target )
 {
+	drainCursors( CN.context );
 	Entity *e = newEntity( source, medium, target );
 	addItem( &CN.DB, e );
-	addItem( &CN.context->frame.log.entities.instantiated, e );
+	logEntity( InstantiateEvent, e, CN.context );
 	return e;
 }
 
 /*---------------------------------------------------------------------------
-	cn_release
+	cn_release, cn_release_entities
 ---------------------------------------------------------------------------*/
 void
 cn_release( Entity *e )
 {
-	if (( e == CN.nil ) || ( e == CN.this ) || ( e->state == -1 ))
-		return;
+	listItem *entities = newItem( e );
+	cn_release_entities( entities );
+	freeItem( entities );
+}
+
+static Entity *
+release_closure( listItem *entities )
+/*
+	returns entities along with all the relationship instances in which
+	these are involved, recursively, dependents first - i.e. in the order
+	in which they are to be released - chained through their next pointer.
+	The entities collected are marked with state -2. The traversal uses an
+	explicit stack, so that the depth of the dependency graph does not
+	matter.
+*/
+{
+	struct { Entity *e; int i; listItem *j; } buffer[ 64 ], *stack = buffer;
+	int size = 64;
+
+	Entity *closure = NULL, *last = NULL;
+	for ( listItem *r = entities; r!=NULL; r=r->next )
+	{
+		Entity *e = (Entity *) r->ptr;
+		if (( e == CN.nil ) || ( e == CN.this ) || ( e->state < 0 ))
+			continue;
+		e->state = -2;
+		stack[ 0 ].e = e;
+		stack[ 0 ].i = 0;
+		stack[ 0 ].j = e->as_sub[ 0 ];
+		for ( int top = 1; top > 0; )
+		{
+			if ( stack[ top - 1 ].j == NULL ) {
+				e = stack[ top - 1 ].e;
+				int i = ++stack[ top - 1 ].i;
+				if ( i < 3 )
+					stack[ top - 1 ].j = e->as_sub[ i ];
+				else {
+					if ( last == NULL ) closure = e;
+					else last->next = e;
+					last = e;
+					top--;
+				}
+				continue;
+			}
+			e = (Entity *) stack[ top - 1 ].j->ptr;
+			stack[ top - 1 ].j = stack[ top - 1 ].j->next;
+			if ( e->state < 0 )
+				continue;
+			e->state = -2;
+			if (( top == size ) && ( stack == buffer )) {
+				stack = malloc( 2 * size * sizeof(*stack) );
+				memcpy( stack, buffer, size * sizeof(*stack) );
+				size *= 2;
+			}
+			else if ( top == size ) {
+				size *= 2;
+				stack = realloc( stack, size * sizeof(*stack) );
+			}
+			stack[ top ].e = e;
+			stack[ top ].i = 0;
+			stack[ top ].j = e->as_sub[ 0 ];
+			top++;
+		}
+	}
+	if ( stack != buffer ) free( stack );
+	return closure;
+}
+
+void
+cn_release_entities( listItem *entities )
+/*
+	releases entities and all their dependents. These are first collected,
+	then torn down all at once - with a single pass through each value
+	account, the name registry and CN.DB - so that the cost is linear in
+	the size of the database, whatever the number of entities released.
+*/
+{
+	drainCursors( CN.context );
+	Entity *closure = release_closure( entities );
+	if ( closure == NULL ) return;
+
+	// log the releases while the entities' names are still available
+
+	for ( Entity *e = closure; e!=NULL; e=e->next )
+		logEntity( ReleaseEvent, e, CN.context );
+
+	// close all value accounts associated with these entities, freeing
+	// their name, hcn and url strings, and setting aside their narratives
+
+	Registry narratives = NULL;
+	for ( registryEntry *va = CN.VB; va!=NULL; va=va->next )
+	{
+		int strings = strcmp( va->identifier, "narratives" );
+		Registry *account = (Registry *) &va->value;
+		registryEntry *last_r = NULL, *next_r;
+		for ( registryEntry *r = *account; r!=NULL; r=next_r )
+		{
+			next_r = r->next;
+			if ((( Entity *) r->identifier )->state != -2 ) {
+				last_r = r;
+				continue;
+			}
+			if ( last_r == NULL ) *account = next_r;
+			else last_r->next = next_r;
+			if ( strings ) {
+				free( r->value );
+				freeRegistryItem( r );
+			} else {
+				r->next = narratives;
+				narratives = r;
+			}
+		}
+	}
+
+	// remove all entities' narratives
+
+	for ( registryEntry *r = narratives; r!=NULL; r=r->next )
+	{
+		for ( registryEntry *i = (Registry) r->value; i!=NULL; i=i->next )
+			removeFromNarrative((Narrative *) i->value, (Entity *) r->identifier );
+		freeRegistry((Registry *) &r->value );
+	}
+	freeRegistry( &narratives );
+
+	// remove entities from name registry
 
-	// we must find all instances where e is involved and release these as well.
-	for ( int i=0; i<3; i++ ) {
-		listItem *next_j;
-		for ( listItem *j=e->as_sub[ i ]; j!=NULL; j=next_j ) {
-			next_j = j->next;
-			cn_release( (Entity *) j->ptr );
+	registryEntry *last_r = NULL, *next_r;
+	for ( registryEntry *r = CN.registry; r!=NULL; r=next_r )
+	{
+		next_r = r->next;
+		if ((( Entity *) r->value )->state != -2 ) {
+			last_r = r;
+			continue;
 		}
+		if ( last_r == NULL ) CN.registry = next_r;
+		else last_r->next = next_r;
+		freeRegistryItem( r );
+	}
+
+	// finally remove entities from CN.DB
+
+	listItem *last_i = NULL, *next_i;
+	for ( listItem *i = CN.DB; i!=NULL; i=next_i )
+	{
+		next_i = i->next;
+		if ((( Entity *) i->ptr )->state == -2 )
+			clipListItem( &CN.DB, i, last_i, next_i );
+		else last_i = i;
 	}
-	Expression *expression = cn_expression( e );
-	addItem( &CN.context->frame.log.entities.released, &expression->sub[ 3 ] );
-	cn_free( e );
+	freeEntities( closure );
 }
 
 /*---------------------------------------------------------------------------
@@ -251,8 +434,9 @@ int
 cn_activate( Entity *e )
 {
 	if ( !cn_is_active( e ) ) {
+		drainCursors( CN.context );
 		e->state = 1;
-		addItem( &CN.context->frame.log.entities.activated, e );
+		logEntity( ActivateEvent, e, CN.context );
 		return 1;
 	}
 	else return 0;
@@ -265,8 +449,9 @@ int
 cn_deactivate( Entity *e )
 {
 	if ( cn_is_active( e ) ) {
+		drainCursors( CN.context );
 		e->state = 0;
-		addItem( &CN.context->frame.log.entities.deactivated, e );
+		logEntity( DeactivateEvent, e, CN.context );
 		return 1;
 	}
 	else return 0;
@@ -371,3 +556,314 @@ cn_deactivate_narrative( Entity *e, char *name )
 	}
 	return 1;
 }
+
+/*---------------------------------------------------------------------------
+	cn_parse, cn_free_expression
+---------------------------------------------------------------------------*/
+Expression *
+cn_parse( char *string )
+/*
+	parses string into an expression which the caller may solve any number
+	of times using cn_solve(), and must free using cn_free_expression().
+	Bypasses read_command(), i.e. no prompt and no output.
+*/
+{
+	_context *context = CN.context;
+	if (( string == NULL ) || ( context->control.mode != ExecutionMode ))
+		return NULL;
+
+	push_input( NULL, string, APIStringInput, context );
+	parse_expression( base, 0, &same, context );
+	pop_input( base, 0, NULL, context );
+
+	Expression *expression = context->expression.ptr;
+	context->expression.ptr = NULL;
+	if ( context->expression.mode == ErrorMode ) {
+		freeExpression( expression );
+		return NULL;
+	}
+	return expression;
+}
+
+void
+cn_free_expression( Expression *expression )
+{
+	freeExpression( expression );
+}
+
+/*---------------------------------------------------------------------------
+	cn_solve
+---------------------------------------------------------------------------*/
+Entity **
+cn_solve( Expression *expression, int *count )
+/*
+	returns the NULL-terminated array of entities matching expression,
+	or NULL if there are none. The array must be freed by the caller.
+*/
+{
+	_context *context = CN.context;
+	if ( count != NULL ) *count = 0;
+	if ( expression == NULL ) return NULL;
+
+	context->expression.mode = EvaluateMode;
+	int success = expression_solve( expression, 3, context );
+	if ( success <= 0 ) {
+		freeListItem( &context->expression.results );
+		return NULL;
+	}
+	int n = 0;
+	for ( listItem *i = context->expression.results; i!=NULL; i=i->next )
+		n++;
+
+	Entity **results = (Entity **) malloc(( n + 1 ) * sizeof( Entity * ));
+	n = 0;
+	for ( listItem *i = context->expression.results; i!=NULL; i=i->next )
+		results[ n++ ] = (Entity *) i->ptr;
+	results[ n ] = NULL;
+	freeListItem( &context->expression.results );
+
+	if ( count != NULL ) *count = n;
+	return results;
+}
+
+/*---------------------------------------------------------------------------
+	cn_cursor, cn_next, cn_close
+---------------------------------------------------------------------------*/
+Cursor *
+cn_cursor( Expression *expression )
+/*
+	returns a cursor yielding, one at a time through cn_next(), the
+	entities which cn_solve() would return - though not in the same
+	order - without these ever being held all at once. The results are
+	those of the database as it is upon opening, which the caller may
+	change meanwhile. The cursor must be closed using cn_close().
+*/
+{
+	CN.context->expression.mode = EvaluateMode;
+	return openCursor( expression, 0, CN.context );
+}
+
+Entity *
+cn_next( Cursor *cursor )
+/*
+	returns the cursor's next entity, or NULL once there are none left
+*/
+{
+	return (Entity *) cursorNext( cursor );
+}
+
+void
+cn_close( Cursor *cursor )
+{
+	closeCursor( cursor );
+}
+
+/*---------------------------------------------------------------------------
+	cn_query
+---------------------------------------------------------------------------*/
+Entity **
+cn_query( char *string, int *count )
+{
+	if ( count != NULL ) *count = 0;
+	Expression *expression = cn_parse( string );
+	if ( expression == NULL ) return NULL;
+	Entity **results = cn_solve( expression, count );
+	freeExpression( expression );
+	return results;
+}
+
+/*---------------------------------------------------------------------------
+	cn_frame
+---------------------------------------------------------------------------*/
+int
+cn_frame( void )
+/*
+	runs one system frame, i.e. processes the changes logged since the last
+	frame - narratives and subscribers alike
+*/
+{
+	return systemFrame( base, 0, &same, CN.context );
+}
+
+/*---------------------------------------------------------------------------
+	cn_batch, cn_commit
+---------------------------------------------------------------------------*/
+void
+cn_batch( void )
+/*
+	holds frame execution - e.g. for bulk ingest - until cn_commit()
+*/
+{
+	CN.context->frame.batch = 1;
+}
+
+int
+cn_commit( void )
+/*
+	ends batch mode, and processes the changes logged in the meantime.
+	Returns the number of frames run.
+*/
+{
+	commitBatch( CN.context );
+	return systemFrames( CN.context );
+}
+
+/*---------------------------------------------------------------------------
+	cn_subscribe
+---------------------------------------------------------------------------*/
+Subscription *
+cn_subscribe( EventType type, Expression *filter, _callback *callback, void *user_data )
+/*
+	callback will be invoked once per frame with the list of changes of the
+	given type logged during that frame - reduced to those matching filter if
+	filter is not NULL. changes holds entities, except for ReleaseEvent where
+	it holds the released entities' literals (ExpressionSub *).
+	Returns NULL if type is not an EventType, or callback is NULL.
+*/
+{
+	if (( type < InstantiateEvent ) || ( type > DeactivateEvent ) || ( callback == NULL ))
+		return NULL;
+	Subscription *subscription = (Subscription *) calloc( 1, sizeof(Subscription) );
+	subscription->type = type;
+	subscription->filter = filter;
+	subscription->callback = callback;
+	subscription->user_data = user_data;
+	addItem( &CN.context->frame.subscribers, subscription );
+	listenersChanged( CN.context );
+	return subscription;
+}
+
+/*---------------------------------------------------------------------------
+	cn_unsubscribe
+---------------------------------------------------------------------------*/
+int
+cn_unsubscribe( Subscription *subscription )
+/*
+	callbacks may unsubscribe any subscription - which is then only marked
+	cancelled, until the notification is complete
+*/
+{
+	listItem **subscribers = &CN.context->frame.subscribers;
+	if (( lookupItem( *subscribers, subscription ) == NULL ) || subscription->cancelled )
+		return 0;
+	if ( CN.context->frame.notifying ) {
+		subscription->cancelled = 1;
+		return 1;
+	}
+	removeItem( subscribers, subscription );
+	listenersChanged( CN.context );
+	free( subscription );
+	return 1;
+}
+
+/*---------------------------------------------------------------------------
+	cn_watch
+---------------------------------------------------------------------------*/
+StandingQuery *
+cn_watch( Expression *expression, _delta *callback, void *user_data )
+/*
+	registers expression as a standing query. callback is invoked at once
+	with the query's current results, and thereafter upon each frame which
+	changed them, with the results added - entities - and removed - their
+	literals (ExpressionSub *), as these entities may no longer exist.
+*/
+{
+	if (( expression == NULL ) || ( callback == NULL ))
+		return NULL;
+
+	StandingQuery *query = (StandingQuery *) calloc( 1, sizeof(StandingQuery) );
+	query->expression = expression;
+	query->callback = callback;
+	query->user_data = user_data;
+	watchQuery( query, CN.context );
+	return query;
+}
+
+/*---------------------------------------------------------------------------
+	cn_unwatch
+---------------------------------------------------------------------------*/
+int
+cn_unwatch( StandingQuery *query )
+{
+	listItem **queries = &CN.context->frame.queries;
+	if ( lookupItem( *queries, query ) == NULL )
+		return 0;
+	removeItem( queries, query );
+	listenersChanged( CN.context );
+	for ( registryEntry *r = query->results; r!=NULL; r=r->next )
+		freeExpression( (Expression *) r->value );
+	freeRegistry( &query->results );
+	freeListItem( &query->terms.names );
+	free( query );
+	return 1;
+}
+
+/*---------------------------------------------------------------------------
+	cn_register_native
+---------------------------------------------------------------------------*/
+int
+cn_register_native( char *name, _native *action, void *user_data )
+/*
+	registers action under name, so that narratives can invoke it by
+		!> name( %variable, ... )
+	action is passed one NULL-terminated array of entities per argument,
+	and is expected to return a negative value on failure
+*/
+{
+	if (( name == NULL ) || ( action == NULL ))
+		return 0;
+
+	NativeVA *native;
+	registryEntry *entry = lookupByName( CN.natives, name );
+	if ( entry == NULL ) {
+		native = (NativeVA *) malloc( sizeof(NativeVA) );
+		registerByName( &CN.natives, strdup( name ), native );
+	}
+	else native = (NativeVA *) entry->value;
+
+	native->action = action;
+	native->user_data = user_data;
+	return 1;
+}
+
+/*---------------------------------------------------------------------------
+	cn_deregister_native
+---------------------------------------------------------------------------*/
+int
+cn_deregister_native( char *name )
+{
+	registryEntry *entry = lookupByName( CN.natives, name );
+	if ( entry == NULL )
+		return 0;
+
+	char *identifier = entry->identifier;
+	free( entry->value );
+	deregisterByAddress( &CN.natives, identifier );
+	free( identifier );
+	return 1;
+}
+
+/*---------------------------------------------------------------------------
+	cn_memory
+---------------------------------------------------------------------------*/
+void
+cn_memory( MemoryStats *stats )
+/*
+	fills stats with the engine's current memory use - see memory.c
+*/
+{
+	memoryStats( stats, CN.context );
+}
+
+/*---------------------------------------------------------------------------
+	cn_compact
+---------------------------------------------------------------------------*/
+long
+cn_compact( void )
+/*
+	gives all empty slabs back to the OS - returns the number of bytes
+	released
+*/
+{
+	return compactMemory( 0 );
+}
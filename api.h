@@ -5,11 +5,21 @@
 	API 		- public
 ---------------------------------------------------------------------------*/
 
+int	cn_init( void );
+Expression *cn_parse( char *string );
+void	cn_free_expression( Expression *expression );
+Entity	**cn_solve( Expression *expression, int *count );
+Entity	**cn_query( char *string, int *count );
+Cursor	*cn_cursor( Expression *expression );
+Entity	*cn_next( Cursor *cursor );
+void	cn_close( Cursor *cursor );
+
 Entity	*cn_new( char *name );
 Entity	*cn_instantiate( Entity *source, Entity *medium, Entity *target );
 int	cn_activate( Entity *e );
 int	cn_deactivate( Entity *e );
 void	cn_release( Entity *e );
+void	cn_release_entities( listItem *entities );
 
 Expression *cn_expression( Entity *e );
 Entity	*cn_entity( char *name );
@@ -26,5 +36,19 @@ int	cn_activate_narrative( Entity *e, char *name );
 int	cn_deactivate_narrative( Entity *e, char *name );
 int	cn_release_narrative( Entity *e, char *name );
 
+int	cn_frame( void );
+void	cn_batch( void );
+int	cn_commit( void );
+Subscription *cn_subscribe( EventType type, Expression *filter, _callback *callback, void *user_data );
+int	cn_unsubscribe( Subscription *subscription );
+StandingQuery *cn_watch( Expression *expression, _delta *callback, void *user_data );
+int	cn_unwatch( StandingQuery *query );
+
+int	cn_register_native( char *name, _native *action, void *user_data );
+int	cn_deregister_native( char *name );
+
+void	cn_memory( MemoryStats *stats );
+long	cn_compact( void );
+
 
 #endif	// API_H
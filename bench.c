@@ -0,0 +1,439 @@
+#define _GNU_SOURCE	// asprintf
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include "database.h"
+#include "registry.h"
+#include "kernel.h"
+
+#include "api.h"
+#include "command.h"
+#include "input.h"
+#include "parallel.h"
+#include "trace.h"
+
+#ifndef CONSENSUS_VERSION
+#define CONSENSUS_VERSION	"unknown"
+#endif
+
+/*---------------------------------------------------------------------------
+	consensus_bench
+---------------------------------------------------------------------------*/
+/*
+	Runs timed scenarios against a synthetic graph, and reports the results
+	as JSON. The graph holds N named entities e0 .. eN-1, and M relations,
+	each source having fanout relations - with mediums is, has, knows and
+	likes in turn - and targeting one of the first hubs entities with
+	probability skew, or else any entity. A given ratio of the relations is
+	activated.
+	The scenarios are written out as one story, which the engine reads as
+	it would any other - so that parsing is part of the cost measured - and
+	which brackets each timed section with the native actions
+		!> bench_start()
+		!> bench_stop()
+	The story is read as a script file, and the report output from an
+	atexit() handler - i.e. also if the engine exits before the end.
+*/
+typedef enum {
+	BulkScenario,
+	ActivateScenario,
+	PointScenario,
+	ScanScenario,
+	InactiveScenario,
+	NegationScenario,
+	FilterScenario,
+	LoopScenario,
+	CascadeScenario,
+	ReleaseScenario,
+	FrameScenario,
+	Scenarios
+}
+Scenario;
+
+static char *scenario_name[ Scenarios ] = {
+	"bulk_instantiate", "activate", "point_query", "scan_active", "scan_inactive",
+	"negation", "literal_filter", "loop", "release_cascade", "release_all", "frames"
+};
+
+static char *medium[ 4 ] = { "is", "has", "knows", "likes" };
+
+static struct {
+	struct {
+		long entities, relations, fanout, hubs, narratives, queries, frames;
+		double skew, active;
+		int runs;
+		uint64_t seed;
+		char *label, *output;
+	} config;
+	char story[ 32 ];	// path of the story file
+	struct {
+		Scenario *scenario;	// per sample, in story order
+		long *ns;
+		long *ops;
+		int count, expected;
+		long start;
+	} samples;
+	FILE *report;
+} Bench = {
+	{ 10000, 30000, 3, 10, 8, 1000, 100, 0.2, 0.5, 5, 1, NULL, NULL }
+};
+
+static long
+now( void )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/*---------------------------------------------------------------------------
+	graph generator
+---------------------------------------------------------------------------*/
+static uint64_t
+hash( uint64_t x )
+/*
+	splitmix64 - relations are generated from their index, so that any of
+	them can be regenerated without replaying the sequence
+*/
+{
+	x += 0x9e3779b97f4a7c15ULL;
+	x = ( x ^ ( x >> 30 )) * 0xbf58476d1ce4e5b9ULL;
+	x = ( x ^ ( x >> 27 )) * 0x94d049bb133111ebULL;
+	return x ^ ( x >> 31 );
+}
+
+typedef struct {
+	long source, target;
+	char *medium;
+}
+Relation;
+
+static Relation
+relation( long i )
+{
+	Relation r;
+	uint64_t h = hash( Bench.config.seed ^ ( i * 0x100000001b3ULL ));
+	long n = Bench.config.entities;
+	long hubs = ( Bench.config.hubs < n ) ? Bench.config.hubs : n;
+	r.source = ( i / Bench.config.fanout ) % n;
+	r.medium = medium[ i % 4 ];
+	if (( h >> 11 ) * ( 1.0 / 9007199254740992.0 ) < Bench.config.skew )
+		r.target = ( h % hubs );
+	else
+		r.target = ( h % n );
+	if ( r.target == r.source )
+		r.target = ( r.target + 1 ) % n;
+	return r;
+}
+
+static int
+is_active( long i )
+{
+	return ( hash( ~Bench.config.seed ^ i ) >> 11 ) * ( 1.0 / 9007199254740992.0 ) < Bench.config.active;
+}
+
+/*---------------------------------------------------------------------------
+	story
+---------------------------------------------------------------------------*/
+static void
+start( FILE *story, Scenario scenario, long ops )
+{
+	int n = Bench.samples.expected++;
+	Bench.samples.scenario[ n ] = scenario;
+	Bench.samples.ops[ n ] = ops;
+	fprintf( story, "!> bench_start()\n" );
+}
+
+static void
+stop( FILE *story )
+{
+	fprintf( story, "!> bench_stop()\n" );
+}
+
+static void
+write_graph( FILE *story, int timed )
+{
+	if ( timed ) start( story, BulkScenario, Bench.config.entities + Bench.config.relations );
+	for ( long i=0; i<Bench.config.entities; i++ )
+		fprintf( story, "!! e%ld\n", i );
+	for ( long i=0; i<Bench.config.relations; i++ ) {
+		Relation r = relation( i );
+		fprintf( story, "!! e%ld-%s->e%ld\n", r.source, r.medium, r.target );
+	}
+	if ( timed ) stop( story );
+
+	long active = 0;
+	for ( long i=0; i<Bench.config.relations; i++ )
+		active += is_active( i );
+	if ( timed ) start( story, ActivateScenario, active );
+	for ( long i=0; i<Bench.config.relations; i++ ) {
+		if ( !is_active( i ) ) continue;
+		Relation r = relation( i );
+		fprintf( story, "!* e%ld-%s->e%ld\n", r.source, r.medium, r.target );
+	}
+	if ( timed ) stop( story );
+}
+
+static void
+write_repeated( FILE *story, Scenario scenario, long ops, char *command )
+{
+	for ( int run=0; run<Bench.config.runs; run++ ) {
+		start( story, scenario, ops );
+		for ( long i=0; i<ops; i++ )
+			fprintf( story, "%s\n", command );
+		stop( story );
+	}
+}
+
+static void
+write_story( FILE *story )
+/*
+	the queries all target entities known to have results - in particular
+	hub, the target of the first relation, whose medium is "is" - as
+	assigning null results to a variable is an error
+*/
+{
+	Relation first = relation( 0 );
+	long hub = first.target;
+	long scans = 10;
+	char *command;
+
+	for ( int run=0; run<Bench.config.runs; run++ ) {
+		fprintf( story, "!~ .\n" );
+		write_graph( story, 1 );
+	}
+
+	// queries
+	for ( int run=0; run<Bench.config.runs; run++ ) {
+		start( story, PointScenario, Bench.config.queries );
+		for ( long i=0; i<Bench.config.queries; i++ ) {
+			long n = hash( Bench.config.seed + run * Bench.config.queries + i ) % (( Bench.config.relations + 3 ) / 4 );
+			fprintf( story, ": r : %%[ ?-is->e%ld ]\n", relation( 4 * n ).target );
+		}
+		stop( story );
+	}
+	write_repeated( story, ScanScenario, scans, ": r : %[ . ]" );
+	write_repeated( story, InactiveScenario, scans, ": r : %[ ~ ]" );
+	if ( Bench.config.relations > 1 )
+		write_repeated( story, NegationScenario, scans, ": r : %[ .-~is->. ]" );
+
+	// the filter holds the literals of hub's "is" relationship instances
+	fprintf( story, ": f : %%[ .-is->e%ld ].$( literal )\n", hub );
+	asprintf( &command, ": r : ?-is->e%ld < %%f", hub );
+	write_repeated( story, FilterScenario, Bench.config.queries, command );
+	free( command );
+
+	asprintf( &command, "?: ?-is->e%ld\n\t: x : %%[ %%? ]\n\t/", hub );
+	write_repeated( story, LoopScenario, scans, command );
+	free( command );
+
+	// releases
+	long hubs = ( Bench.config.hubs < Bench.config.entities ) ? Bench.config.hubs : Bench.config.entities;
+	for ( int run=0; run<Bench.config.runs; run++ ) {
+		fprintf( story, "!~ .\n" );
+		write_graph( story, 0 );
+		start( story, CascadeScenario, hubs );
+		for ( long i=0; i<hubs; i++ )
+			fprintf( story, "!~ e%ld\n", i );
+		stop( story );
+	}
+	for ( int run=0; run<Bench.config.runs; run++ ) {
+		write_graph( story, 0 );
+		start( story, ReleaseScenario, 1 );
+		fprintf( story, "!~ .\n" );
+		stop( story );
+	}
+
+	// frames - the narratives are defined last, as they would otherwise
+	// process all the changes made above
+	write_graph( story, 0 );
+	for ( long k=0; k<Bench.config.narratives; k++ ) {
+		fprintf( story, "!! bench%ld()\n\ton e: . !! do\n\t\t: n : %%e\n\t\t/.\n\t/\n", k );
+		fprintf( story, "!* bench%ld()\n", k );
+	}
+	for ( int run=0; run<Bench.config.runs; run++ ) {
+		start( story, FrameScenario, Bench.config.frames );
+		for ( long i=0; i<Bench.config.frames; i++ )
+			fprintf( story, "!! f%d_%ld-is->e%ld\n", run, i, hub );
+		stop( story );
+	}
+}
+
+/*---------------------------------------------------------------------------
+	bench natives
+---------------------------------------------------------------------------*/
+static int
+bench_start( int argc, Entity **argv[], void *user_data )
+{
+	Bench.samples.start = now();
+	return 0;
+}
+
+static int
+bench_stop( int argc, Entity **argv[], void *user_data )
+{
+	long ns = now() - Bench.samples.start;
+	if ( Bench.samples.count < Bench.samples.expected )
+		Bench.samples.ns[ Bench.samples.count++ ] = ns;
+	return 0;
+}
+
+/*---------------------------------------------------------------------------
+	report
+---------------------------------------------------------------------------*/
+static int
+compare( const void *a, const void *b )
+{
+	long x = *(long *) a, y = *(long *) b;
+	return ( x > y ) - ( x < y );
+}
+
+static void
+report( void )
+{
+	FILE *out = Bench.report;
+	fflush( stdout );
+	unlink( Bench.story );
+	if ( Bench.samples.count < Bench.samples.expected ) {
+		fprintf( stderr, "consensus_bench: story stopped after %d of %d samples\n",
+			Bench.samples.count, Bench.samples.expected );
+		_exit( EXIT_FAILURE );
+	}
+	struct rusage usage;
+	getrusage( RUSAGE_SELF, &usage );
+	MemoryStats memory;
+	cn_memory( &memory );
+
+	fprintf( out, "{\n\t\"version\": \"%s\",\n", CONSENSUS_VERSION );
+	fprintf( out, "\t\"label\": " );
+	traceString( out, ( Bench.config.label == NULL ) ? "" : Bench.config.label );
+	fprintf( out, ",\n" );
+	fprintf( out, "\t\"config\": { \"entities\": %ld, \"relations\": %ld, \"fanout\": %ld, \"hubs\": %ld, "
+		"\"skew\": %g, \"active\": %g, \"narratives\": %ld, \"queries\": %ld, \"frames\": %ld, "
+		"\"runs\": %d, \"seed\": %llu, \"threads\": %d },\n",
+		Bench.config.entities, Bench.config.relations, Bench.config.fanout, Bench.config.hubs,
+		Bench.config.skew, Bench.config.active, Bench.config.narratives, Bench.config.queries,
+		Bench.config.frames, Bench.config.runs, (unsigned long long) Bench.config.seed,
+		parallel_workers() + 1 );
+	fprintf( out, "\t\"max_rss_kb\": %ld,\n", usage.ru_maxrss );
+	fprintf( out, "\t\"heap_bytes\": %ld,\n", memory.heap );
+	fprintf( out, "\t\"scenarios\": [" );
+
+	long *ns = (long *) malloc( Bench.config.runs * sizeof(long) );
+	int first = 1;
+	for ( int s=0; s<Scenarios; s++ ) {
+		int runs = 0;
+		long ops = 0;
+		double mean = 0;
+		for ( int i=0; i<Bench.samples.count; i++ ) {
+			if ( Bench.samples.scenario[ i ] != s ) continue;
+			ns[ runs++ ] = Bench.samples.ns[ i ];
+			ops = Bench.samples.ops[ i ];
+			mean += Bench.samples.ns[ i ];
+		}
+		if ( runs == 0 ) continue;
+		mean /= runs;
+		qsort( ns, runs, sizeof(long), compare );
+		long median = ( runs % 2 ) ? ns[ runs / 2 ] : ( ns[ runs / 2 - 1 ] + ns[ runs / 2 ] ) / 2;
+		fprintf( out, "%s\n\t\t{ \"name\": \"%s\", \"ops\": %ld, \"runs\": %d, "
+			"\"min_ns\": %ld, \"median_ns\": %ld, \"mean_ns\": %.0f, \"max_ns\": %ld, "
+			"\"ns_per_op\": %.1f, \"samples_ns\": [",
+			first ? "" : ",", scenario_name[ s ], ops, runs,
+			ns[ 0 ], median, mean, ns[ runs - 1 ], ops ? (double) median / ops : 0.0 );
+		for ( int i=0, j=0; i<Bench.samples.count; i++ )
+			if ( Bench.samples.scenario[ i ] == s )
+				fprintf( out, "%s%ld", j++ ? ", " : " ", Bench.samples.ns[ i ] );
+		fprintf( out, " ] }" );
+		first = 0;
+	}
+	fprintf( out, "\n\t]\n}\n" );
+	fclose( out );
+	free( ns );
+}
+
+/*---------------------------------------------------------------------------
+	main
+---------------------------------------------------------------------------*/
+static void
+usage( char *name )
+{
+	fprintf( stderr, "usage: %s [ -n entities ] [ -m relations ] [ -f fanout ] [ -H hubs ] [ -s skew ]\n"
+		"\t[ -a active-ratio ] [ -k narratives ] [ -q queries ] [ -b frames ] [ -r runs ]\n"
+		"\t[ --seed number ] [ --label text ] [ -o file.json ]\n", name );
+	exit( EXIT_FAILURE );
+}
+
+int
+main( int argc, char ** argv )
+{
+	for ( int i=1; i<argc; i++ ) {
+		char *option = argv[ i ];
+		if ( i + 1 == argc ) usage( argv[ 0 ] );
+		char *value = argv[ ++i ];
+		if ( !strcmp( option, "-n" ) ) Bench.config.entities = atol( value );
+		else if ( !strcmp( option, "-m" ) ) Bench.config.relations = atol( value );
+		else if ( !strcmp( option, "-f" ) ) Bench.config.fanout = atol( value );
+		else if ( !strcmp( option, "-H" ) ) Bench.config.hubs = atol( value );
+		else if ( !strcmp( option, "-s" ) ) Bench.config.skew = atof( value );
+		else if ( !strcmp( option, "-a" ) ) Bench.config.active = atof( value );
+		else if ( !strcmp( option, "-k" ) ) Bench.config.narratives = atol( value );
+		else if ( !strcmp( option, "-q" ) ) Bench.config.queries = atol( value );
+		else if ( !strcmp( option, "-b" ) ) Bench.config.frames = atol( value );
+		else if ( !strcmp( option, "-r" ) ) Bench.config.runs = atoi( value );
+		else if ( !strcmp( option, "--seed" ) ) Bench.config.seed = strtoull( value, NULL, 10 );
+		else if ( !strcmp( option, "--label" ) ) Bench.config.label = value;
+		else if ( !strcmp( option, "-o" ) ) Bench.config.output = value;
+		else usage( argv[ 0 ] );
+	}
+	if (( Bench.config.entities < 2 ) || ( Bench.config.relations < 1 ) || ( Bench.config.fanout < 1 ) ||
+	    ( Bench.config.hubs < 1 ) || ( Bench.config.runs < 1 ) || ( Bench.config.queries < 1 ) ||
+	    ( Bench.config.frames < 1 ) || ( Bench.config.narratives < 0 ))
+		usage( argv[ 0 ] );
+
+	// the report goes to the original stdout, unless a file is given,
+	// while the engine's own output is discarded
+	Bench.report = ( Bench.config.output == NULL ) ?
+		fdopen( dup( STDOUT_FILENO ), "w" ) :
+		fopen( Bench.config.output, "w" );
+	if ( Bench.report == NULL ) {
+		perror( "consensus_bench" );
+		return EXIT_FAILURE;
+	}
+
+	strcpy( Bench.story, "/tmp/consensus_bench_XXXXXX" );
+	int fd = mkstemp( Bench.story );
+	if ( fd < 0 ) {
+		perror( "consensus_bench" );
+		return EXIT_FAILURE;
+	}
+	FILE *story = fdopen( fd, "w" );
+	int samples = Bench.config.runs * Scenarios;
+	Bench.samples.scenario = (Scenario *) malloc( samples * sizeof(Scenario) );
+	Bench.samples.ns = (long *) calloc( samples, sizeof(long) );
+	Bench.samples.ops = (long *) calloc( samples, sizeof(long) );
+	write_story( story );
+	fclose( story );
+
+	cn_init();
+	cn_register_native( "bench_start", bench_start, NULL );
+	cn_register_native( "bench_stop", bench_stop, NULL );
+	atexit( report );
+
+	fflush( stdout );
+	int null = open( "/dev/null", O_RDWR );
+	dup2( null, STDOUT_FILENO );
+	dup2( null, STDIN_FILENO );
+	close( null );
+
+	queue_input( strdup( Bench.story ), NULL, CN.context );
+	CN.context->control.quiet = 1;
+	CN.context->input.headless = 1;
+	read_command( base, 0, &same, CN.context );
+	return EXIT_SUCCESS;
+}
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE	// asprintf
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -15,8 +16,12 @@
 #include "output.h"
 #include "expression.h"
 #include "narrative.h"
+#include "native.h"
 #include "variables.h"
 #include "value.h"
+#include "trace.h"
+#include "memory.h"
+#include "replay.h"
 
 // #define DEBUG
 
@@ -146,19 +151,22 @@ command_expression( char *state, int event, char **next_state, _context *context
 {
 	if ( !context_check( 0, 0, ExecutionMode ) )
 		return 0;
+	// expression_solve() instantiates
+	if (( context->expression.mode == InstantiateMode ) && serialOnly( context ))
+		return raise_error( context, event, NULL );
 
 	int retval = expression_solve( context->expression.ptr, 3, context );
 	if ( retval == -1 ) return raise_error( context, event, NULL );
 
+	if ( deferChanges( context->expression.mode, context->expression.results, context ) )
+		return event;
+
 	switch ( context->expression.mode ) {
 	case InstantiateMode:
 		// already done during expression_solve
 		break;
 	case ReleaseMode:
-		for ( listItem *i = context->expression.results; i!=NULL; i=i->next ) {
-			Entity *e = (Entity *) i->ptr;
-			cn_release( e );
-		}
+		cn_release_entities( context->expression.results );
 		break;
 	case ActivateMode:
 		for ( listItem *i = context->expression.results; i!=NULL; i=i->next ) {
@@ -197,10 +205,11 @@ evaluate_expression( char *state, int event, char **next_state, _context *contex
 	   resolve the filtered results if there are. Note that expression_solve
 	   may revert to EvaluateMode depending on the filter variable type.
 	*/
+	int exist = 0;	// conditions only need to know whether there are results
 	bgn_
 	in_( "? identifier:" )	restore_mode = 0;
-	in_( "?~ %:" )		restore_mode = 0;
-	in_( "? %:" )		restore_mode = 0;
+	in_( "?~ %:" )		restore_mode = 0; exist = 1;
+	in_( "? %:" )		restore_mode = 0; exist = 1;
 	end
 
 	command_do_( parse_expression, same );
@@ -210,6 +219,7 @@ evaluate_expression( char *state, int event, char **next_state, _context *contex
 			context->expression.mode =
 				( restore_mode || ( context->expression.filter_identifier == NULL )) ?
 				EvaluateMode : ReadMode;
+			context->expression.exist = exist;
 			int retval = expression_solve( context->expression.ptr, 3, context );
 			if ( retval < 0 ) event = retval;
 		}
@@ -265,24 +275,32 @@ overwrite_narrative( Entity *e, _context *context )
 	}
 	else	// let's talk...
 	{
-		int overwrite = 0;
+		int overwrite = 0, event;
 		if ( e == CN.nil ) {
 			fprintf( stderr, "consensus> Warning: narrative '%s()' already exists. ", name );
 		} else {
 			fprintf( stderr, "consensus> Warning: narrative %%'" ); output_name( e, NULL, 0 );
 			fprintf( stderr, ".%s()' already exists. ", name );
 		}
-		do {
+		if ( context->control.quiet ) {
+			fprintf( stderr, "Overwriting\n" );
+			overwrite = 'y';
+		}
+		else do {
 			fprintf( stderr, "Overwrite? (y/n)_ " );
-			overwrite = getchar();
+			overwrite = replayGetchar();
 			switch ( overwrite ) {
+			case EOF:
+				overwrite = 'n';
+				break;
 			case 'y':
 			case 'n':
-				if ( getchar() == '\n' )
+				if ( replayGetchar() == '\n' )
 					break;
 			default:
 				overwrite = 0;
-				while ( getchar() != '\n' );
+				do event = replayGetchar();
+				while (( event != '\n' ) && ( event != EOF ));
 				break;
 			}
 		}
@@ -300,6 +318,8 @@ command_narrative( char *state, int event, char **next_state, _context *context
 {
 	if ( !context_check( 0, 0, ExecutionMode ) )
 		return 0;
+	if ( serialOnly( context ) )
+		return raise_error( context, event, NULL );
 
 	switch ( context->expression.mode ) {
 	case InstantiateMode:
@@ -327,7 +347,8 @@ command_narrative( char *state, int event, char **next_state, _context *context
 		}
 		if ( do_register ) {
 			registerNarrative( narrative, context );
-			fprintf( stderr, "consensus> narrative instantiated: %s()\n", narrative->name );
+			if ( !context->control.quiet )
+				fprintf( stderr, "consensus> narrative instantiated: %s()\n", narrative->name );
 		} else {
 			freeNarrative( narrative );
 			fprintf( stderr, "consensus> Warning: no target entity - narrative not instantiated\n" );
@@ -582,6 +603,8 @@ command_push_input( InputType type, int event, _context *context )
 		push_input( NULL, NULL, LastInstruction, context );
 		break;
 	case ExecutionMode:
+		if ( serialOnly( context ) )
+			return raise_error( context, event, NULL );
 		if ( context->identifier.id[ 0 ].type != StringIdentifier ) {
 			return raise_error( context, event, "expected argument in \"quotes\"" );
 		}
@@ -725,6 +748,155 @@ command_pop( char *state, int event, char **next_state, _context *context )
 	return ( do_pop ? event : 0 );
 }
 
+/*---------------------------------------------------------------------------
+	command_directive
+---------------------------------------------------------------------------*/
+static char *
+unquote( char *string )
+{
+	char *s = strdup( string + ( *string == '\"' ));
+	int len = strlen( s );
+	if (( len > 0 ) && ( s[ len - 1 ] == '\"' )) s[ len - 1 ] = '\0';
+	return s;
+}
+
+static int
+command_directive( char *state, int event, char **next_state, _context *context )
+/*
+	:directive [ argument ]
+	sets the engine's run-time options, e.g.
+		:defer immediate|last|first|strict
+		:frames cap
+		:batch ... :commit
+		:compact [ keep ]
+		:explain %[ expression ]
+		:profile on|off|reset|report [ top ]
+		:stats frame [ reset | "file" ] | mem
+		:trace "file"|off
+*/
+{
+	if ( !context_check( 0, 0, ExecutionMode ) )
+		return 0;
+	if ( serialOnly( context ) )
+		return raise_error( context, event, NULL );
+
+	char *directive = context->identifier.id[ 0 ].ptr;
+	char *argument = strncmp( state, ": identifier argument", 21 ) ? NULL : context->identifier.id[ 1 ].ptr;
+	char *option = strcmp( state, ": identifier argument argument" ) ? NULL : context->identifier.id[ 2 ].ptr;
+	int expression = !strcmp( state, ": identifier %[_]" );
+
+	if ( !strcmp( directive, "explain" ) ) {
+		if ( !expression || ( context->expression.mode == ErrorMode ))
+			return raise_error( context, event, "usage: :explain %[ expression ]" );
+		int restore_mode = context->expression.mode;
+		context->expression.mode = ( context->expression.filter_identifier == NULL ) ?
+			EvaluateMode : ReadMode;
+		int retval = explainExpression( context->expression.ptr, context );
+		context->expression.mode = restore_mode;
+		if ( retval < 0 ) return retval;
+	}
+	else if ( expression ) {
+		char *msg; asprintf( &msg, "directive ':%s' does not take an expression", directive );
+		event = raise_error( context, event, msg ); free( msg );
+		return event;
+	}
+	else if (( option != NULL ) && strcmp( directive, "profile" ) && strcmp( directive, "stats" )) {
+		char *msg; asprintf( &msg, "directive ':%s' takes one argument at most", directive );
+		event = raise_error( context, event, msg ); free( msg );
+		return event;
+	}
+	else if ( !strcmp( directive, "defer" ) ) {
+		if (( argument == NULL ) || ( setWritePolicy( argument, context ) < 0 ))
+			return raise_error( context, event, "usage: :defer immediate|last|first|strict" );
+	}
+	else if ( !strcmp( directive, "batch" ) ) {
+		context->frame.batch = 1;
+	}
+	else if ( !strcmp( directive, "commit" ) ) {
+		commitBatch( context );	// frames are run upon return to base
+	}
+	else if ( !strcmp( directive, "profile" ) ) {
+		if ( argument == NULL )
+			return raise_error( context, event, "usage: :profile on|off|reset|report [ top ]" );
+		else if ( option != NULL ) {
+			if ( strcmp( argument, "report" ) || ( atoi( option ) <= 0 ))
+				return raise_error( context, event, "usage: :profile report [ top ]" );
+			outputProfile( atoi( option ) );
+		}
+		else if ( !strcmp( argument, "on" ) )
+			profileExpressions( 1 );
+		else if ( !strcmp( argument, "off" ) )
+			profileExpressions( 0 );
+		else if ( !strcmp( argument, "reset" ) )
+			resetProfile();
+		else if ( !strcmp( argument, "report" ) )
+			outputProfile( 10 );
+		else
+			return raise_error( context, event, "usage: :profile on|off|reset|report [ top ]" );
+	}
+	else if ( !strcmp( directive, "stats" ) ) {
+		if (( argument != NULL ) && !strcmp( argument, "mem" ) && ( option == NULL ))
+			outputMemoryStats( stdout, context );
+		else if (( argument == NULL ) || strcmp( argument, "frame" ))
+			return raise_error( context, event, "usage: :stats frame [ reset | \"file\" ] | mem" );
+		else if ( option == NULL )
+			outputFrameStats( stdout, 0 );
+		else if ( !strcmp( option, "reset" ) )
+			resetFrameStats();
+		else {
+			// the file name comes "quoted"
+			char *path = unquote( option );
+			FILE *stream = fopen( path, "w" );
+			if ( stream == NULL ) {
+				char *msg; asprintf( &msg, "could not open '%s' for writing", path );
+				event = raise_error( context, event, msg ); free( msg ); free( path );
+				return event;
+			}
+			outputFrameStats( stream, 1 );
+			fclose( stream );
+			free( path );
+		}
+	}
+	else if ( !strcmp( directive, "trace" ) ) {
+		if ( argument == NULL )
+			return raise_error( context, event, "usage: :trace \"file\"|off" );
+		else if ( !strcmp( argument, "off" ) )
+			traceClose();
+		else {
+			// the file name comes "quoted"
+			char *path = unquote( argument );
+			if ( traceOpen( path ) < 0 ) {
+				char *msg; asprintf( &msg, "could not open '%s' for writing", path );
+				event = raise_error( context, event, msg ); free( msg ); free( path );
+				return event;
+			}
+			free( path );
+		}
+	}
+	else if ( !strcmp( directive, "compact" ) ) {
+		if ( argument == NULL )
+			compactMemory( 0 );
+		else if ( !*argument || ( strspn( argument, "0123456789" ) != strlen( argument ) ))
+			return raise_error( context, event, "usage: :compact [ number-of-empty-slabs-kept-per-pool ]" );
+		else {
+			context->memory.keep = atol( argument );
+			compactMemory( context->memory.keep );
+		}
+	}
+	else if ( !strcmp( directive, "frames" ) ) {
+		int cap = ( argument == NULL ) ? 0 : atoi( argument );
+		if ( cap <= 0 )
+			return raise_error( context, event, "usage: :frames maximum-number-of-frames-per-command" );
+		context->frame.cap = cap;
+	}
+	else {
+		char *msg; asprintf( &msg, "unknown directive ':%s'", directive );
+		event = raise_error( context, event, msg ); free( msg );
+		return event;
+	}
+	return 0;
+}
+
 /*---------------------------------------------------------------------------
 	system_frame
 ---------------------------------------------------------------------------*/
@@ -733,13 +905,8 @@ system_frame( char *state, int event, char **next_state, _context *context )
 {
 	if ( context_check( 0, 0, ExecutionMode ) && !strcmp( state, base ) &&
 	   ( context->control.level == 0 ) && ( event == 0 )) {
-
-		// 1. translate occurrences into events
-		// 2. translate events into actions
-		// 3. execute actions
-		for ( int i=0; i<3; i++ ) {
-			command_do_( systemFrame, same );
-		}
+		if ( !context->frame.batch )
+			systemFrames( context );
 	}
 	return event;
 }
@@ -772,6 +939,7 @@ command_error( char *state, int event, char **next_state, _context *context )
 int
 read_command( char *state, int event, char **next_state, _context *context )
 {
+	long command = 0;	// trace start of the current command
 	do {
 	event = input( state, event, NULL, context );
 
@@ -800,8 +968,33 @@ read_command( char *state, int event, char **next_state, _context *context )
 			on_( '~' )	command_do_( set_expression_mode, "!." )
 			on_( '*' )	command_do_( set_expression_mode, "!." )
 			on_( '_' )	command_do_( set_expression_mode, "!." )
+			on_( '>' )	command_do_( nop, "!>" )
 			on_other	command_do_( error, base )
 			end
+			in_( "!>" ) bgn_
+				on_( ' ' )	command_do_( nop, same )
+				on_( '\t' )	command_do_( nop, same )
+				on_other	command_do_( read_argument, "!> native" )
+				end
+				in_( "!> native" ) bgn_
+					on_( ' ' )	command_do_( nop, same )
+					on_( '\t' )	command_do_( nop, same )
+					on_( '(' )	command_do_( read_native_args, "!> native(_)" )
+					on_other	command_do_( error, base )
+					end
+					in_( "!> native(_)" )
+						if ( context->narrative.mode.action.one ) bgn_
+							on_( ' ' )	command_do_( command_native, out )
+							on_( '\t' )	command_do_( command_native, out )
+							on_( '\n' )	command_do_( command_native, out )
+							on_other	command_do_( nothing, out )
+							end
+						else bgn_
+							on_( ' ' )	command_do_( nop, same )
+							on_( '\t' )	command_do_( nop, same )
+							on_( '\n' )	command_do_( command_native, base )
+							on_other	command_do_( error, base )
+							end
 			in_( "!." ) bgn_
 				on_( ' ' )	command_do_( nop, same )
 				on_( '\t' )	command_do_( nop, same )
@@ -937,8 +1130,34 @@ read_command( char *state, int event, char **next_state, _context *context )
 		on_( ' ' )	command_do_( nop, same )
 		on_( '\t' )	command_do_( nop, same )
 		on_( ':' )	command_do_( nop, ">:" )
+		on_( '>' )	command_do_( nop, ">>" )
 		on_other	command_do_( error, base )
 		end
+		in_( ">>" ) bgn_
+			on_( ' ' )	command_do_( nop, same )
+			on_( '\t' )	command_do_( nop, same )
+			on_( '%' )	command_do_( nop, ">> %" )
+			on_other	command_do_( error, base )
+			end
+			in_( ">> %" ) bgn_
+				on_( '[' )	command_do_( nop, ">> %[" )
+				on_other	command_do_( error, base )
+				end
+				in_( ">> %[" ) bgn_
+					on_any	command_do_( read_expression, ">> %[_" )
+					end
+					in_( ">> %[_" ) bgn_
+						on_( ' ' )	command_do_( nop, same )
+						on_( '\t' )	command_do_( nop, same )
+						on_( ']' )	command_do_( nop, ">> %[_]" )
+						on_other	command_do_( error, base )
+						end
+						in_( ">> %[_]" ) bgn_
+							on_( ' ' )	command_do_( nop, same )
+							on_( '\t' )	command_do_( nop, same )
+							on_( '\n' )	command_do_( output_query, RETURN )
+							on_other	command_do_( error, base )
+							end
 		in_( ">:" ) bgn_
 			on_( '\n' )	command_do_( output_char, RETURN )
 			on_( '%' )	command_do_( nop, ">: %" )
@@ -1087,10 +1306,42 @@ read_command( char *state, int event, char **next_state, _context *context )
 		in_( ": identifier" ) bgn_
 			on_( ' ' )	command_do_( nop, same )
 			on_( '\t' )	command_do_( nop, same )
-			on_( '\n' )	command_do_( error, base )
+			on_( '\n' )	command_do_( command_directive, base )
 			on_( ':' )	command_do_( nop, ": identifier :" )
-			on_other	command_do_( error, base )
+			on_( '%' )	command_do_( nop, ": identifier %" )
+			on_other	command_do_( read_argument, ": identifier argument" )
 			end
+			in_( ": identifier %" ) bgn_
+				on_( '[' )	command_do_( nop, ": identifier %[" )
+				on_other	command_do_( error, base )
+				end
+				in_( ": identifier %[" ) bgn_
+					on_any	command_do_( read_expression, ": identifier %[_" )
+					end
+					in_( ": identifier %[_" ) bgn_
+						on_( ' ' )	command_do_( nop, same )
+						on_( '\t' )	command_do_( nop, same )
+						on_( ']' )	command_do_( nop, ": identifier %[_]" )
+						on_other	command_do_( error, base )
+						end
+						in_( ": identifier %[_]" ) bgn_
+							on_( ' ' )	command_do_( nop, same )
+							on_( '\t' )	command_do_( nop, same )
+							on_( '\n' )	command_do_( command_directive, base )
+							on_other	command_do_( error, base )
+							end
+			in_( ": identifier argument" ) bgn_
+				on_( ' ' )	command_do_( nop, same )
+				on_( '\t' )	command_do_( nop, same )
+				on_( '\n' )	command_do_( command_directive, base )
+				on_other	command_do_( read_va_identifier, ": identifier argument argument" )
+				end
+				in_( ": identifier argument argument" ) bgn_
+					on_( ' ' )	command_do_( nop, same )
+					on_( '\t' )	command_do_( nop, same )
+					on_( '\n' )	command_do_( command_directive, base )
+					on_other	command_do_( error, base )
+					end
 			in_( ": identifier :" ) bgn_
 				on_( ' ' )	command_do_( nop, same )
 				on_( '\t' )	command_do_( nop, same )
@@ -1278,11 +1529,22 @@ read_command( char *state, int event, char **next_state, _context *context )
 								end
 	end
 
+	// trace each command, from its first character to its return to base
+	if ( strcmp( state, base ) && strcmp( state, "" ) ) {
+		if ( !command ) command = traceClock();
+	}
+	else if ( command ) {
+		traceSpan( "command", "read_command", command, NULL );
+		command = 0;
+	}
+
 	// invoke system frame upon each return to base
 	command_do_( system_frame, same )
 
 	}
-	while ( strcmp( state, "" ) );
+	while ( strcmp( state, "" ) &&
+		// returns at the end of input - see input()
+		!( context->input.eof && ( context->input.stack == NULL ) && !strcmp( state, base )));
 
 	return event;
 }
@@ -1,27 +1,167 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "database.h"
 #include "registry.h"
+#include "slab.h"
 
-static Entity *freeEntityList = NULL;
-static listItem *freeItemList = NULL;
+static SlabPool EntityPool = SLAB_POOL( Entity );
 
-Entity *
-newEntity( Entity *source, Entity *medium, Entity *target )
+/*
+	listItems are allocated and freed in whichever thread - solver tasks
+	allocate them - so that each thread keeps its own cache of free items,
+	taken from and given back to the shared pool by batches, under lock.
+	The caches are bounded, so that freed items find their way back to
+	their slabs. Each thread registers its cache count upon first use, for
+	itemPoolStats(), together with a thread-specific key whose destructor
+	spills the cache and unregisters the count when the thread exits.
+*/
+#define ITEM_CACHE	256	// maximum number of items cached per thread
+
+typedef struct _ItemCount {
+	long *free;
+	struct _ItemCount *next;
+}
+ItemCount;
+
+static __thread listItem *freeItemList = NULL;
+static __thread long freeItemCount = 0;
+static __thread int itemCounted = 0;	// whether freeItemCount is registered
+
+static struct {
+	pthread_mutex_t lock;
+	SlabPool slabs;
+	ItemCount *counts;
+} ItemPool = { PTHREAD_MUTEX_INITIALIZER, SLAB_POOL( listItem ), NULL };
+
+static pthread_key_t ItemKey;
+static pthread_once_t ItemKeyOnce = PTHREAD_ONCE_INIT;
+
+static void
+uncount_items( void *count )
+/*
+	invoked upon the exit of a thread which used the item cache - the
+	exiting thread's own __thread variables are still valid here
+*/
 {
-	Entity *e;
+	pthread_mutex_lock( &ItemPool.lock );
+	for ( ; freeItemCount > 0; freeItemCount-- ) {
+		listItem *item = freeItemList;
+		freeItemList = item->next;
+		slabFree( &ItemPool.slabs, item );
+	}
+	for ( ItemCount **i = &ItemPool.counts; *i!=NULL; i=&(*i)->next )
+		if ( *i == count ) {
+			*i = (*i)->next;
+			break;
+		}
+	pthread_mutex_unlock( &ItemPool.lock );
+	free( count );
+}
 
-	if ( freeEntityList == NULL ) 
-		e = calloc( 1, sizeof( Entity ) );
-	else
-	{
-		e = freeEntityList;
-		freeEntityList = freeEntityList->next;
-		e->next = NULL;
-		e->state = 0;
+static void
+item_key( void )
+{
+	pthread_key_create( &ItemKey, uncount_items );
+}
+
+static void
+count_items( void )
+{
+	ItemCount *count = (ItemCount *) malloc( sizeof(ItemCount) );
+	count->free = &freeItemCount;
+	pthread_mutex_lock( &ItemPool.lock );
+	count->next = ItemPool.counts;
+	ItemPool.counts = count;
+	pthread_mutex_unlock( &ItemPool.lock );
+	pthread_once( &ItemKeyOnce, item_key );
+	pthread_setspecific( ItemKey, count );
+	itemCounted = 1;
+}
+
+static void
+fill_items( void )
+{
+	if ( !itemCounted ) count_items();
+	pthread_mutex_lock( &ItemPool.lock );
+	for ( ; freeItemCount < ITEM_CACHE / 2; freeItemCount++ ) {
+		listItem *item = slabAlloc( &ItemPool.slabs );
+		item->next = freeItemList;
+		freeItemList = item;
 	}
+	pthread_mutex_unlock( &ItemPool.lock );
+}
+
+static void
+spill_items( long keep )
+{
+	pthread_mutex_lock( &ItemPool.lock );
+	for ( ; freeItemCount > keep; freeItemCount-- ) {
+		listItem *item = freeItemList;
+		freeItemList = item->next;
+		slabFree( &ItemPool.slabs, item );
+	}
+	pthread_mutex_unlock( &ItemPool.lock );
+}
+
+void
+entityPoolStats( PoolStats *stats )
+{
+	slabStats( &EntityPool, stats );
+}
+
+void
+itemPoolStats( PoolStats *stats )
+/*
+	the items cached by threads are in use as far as the pool is concerned.
+	The other threads' counts may be read while they change - which is
+	tolerable here
+*/
+{
+	pthread_mutex_lock( &ItemPool.lock );
+	slabStats( &ItemPool.slabs, stats );
+	for ( ItemCount *i = ItemPool.counts; i!=NULL; i=i->next ) {
+		stats->live -= *i->free;
+		stats->free += *i->free;
+	}
+	pthread_mutex_unlock( &ItemPool.lock );
+}
+
+long
+compactEntities( long keep )
+/*
+	releases the entities' empty slabs, but for keep of them. Returns the
+	number of bytes released.
+*/
+{
+	return slabCompact( &EntityPool, keep );
+}
+
+long
+compactItems( long keep )
+/*
+	gives the calling thread's cached items back to their slabs, then
+	releases the empty slabs, but for keep of them. Returns the number of
+	bytes released.
+*/
+{
+	spill_items( 0 );
+	pthread_mutex_lock( &ItemPool.lock );
+	long released = slabCompact( &ItemPool.slabs, keep );
+	pthread_mutex_unlock( &ItemPool.lock );
+	return released;
+}
+
+Entity *
+newEntity( Entity *source, Entity *medium, Entity *target )
+{
+	Entity *e = slabAlloc( &EntityPool );
+	e->next = NULL;
+	e->state = 0;
+	e->logged = 0;
 
 	e->sub[0] = source;
 	e->sub[1] = medium;
@@ -71,8 +211,71 @@ freeEntity( Entity *entity )
 	}
 
 	entity->state = -1;
-	entity->next = freeEntityList;
-	freeEntityList = entity;
+	if ( !entity->logged )
+		slabFree( &EntityPool, entity );
+}
+
+void
+reclaimEntity( Entity *entity )
+/*
+	gives back to the pool a released entity which the frame logs still
+	listed, and which was therefore kept until these logs were compacted
+	- see compact_log() in frame.c
+*/
+{
+	entity->logged = 0;
+	slabFree( &EntityPool, entity );
+}
+
+void
+freeEntities( Entity *entities )
+/*
+	frees all entities - chained through their next pointer - at once.
+	These must be marked for release, i.e. have state -2, and include all
+	their dependents, so that only the surviving subs' as_sub lists need
+	to be pruned, each in a single pass. Entities which the frame logs
+	still list are only marked freed, until reclaimEntity().
+*/
+{
+	// survivors are chained through their next pointer, the last one
+	// pointing to itself - live entities' next pointer is otherwise NULL
+	Entity *survivors = NULL;
+	for ( Entity *entity = entities; entity!=NULL; entity=entity->next )
+	{
+		for ( int j=0; j<3; j++ )
+		{
+			Entity *sub = entity->sub[ j ];
+			if (( sub == NULL ) || ( sub->state < 0 ) || ( sub->next != NULL ))
+				continue;
+			sub->next = ( survivors == NULL ) ? sub : survivors;
+			survivors = sub;
+		}
+	}
+	for ( Entity *sub = survivors, *next; sub!=NULL; sub=next )
+	{
+		next = ( sub->next == sub ) ? NULL : sub->next;
+		sub->next = NULL;
+		for ( int j=0; j<3; j++ )
+		{
+			listItem *last_i = NULL, *next_i;
+			for ( listItem *i = sub->as_sub[ j ]; i!=NULL; i=next_i )
+			{
+				next_i = i->next;
+				if ( ((Entity *) i->ptr )->state == -2 )
+					clipListItem( &sub->as_sub[ j ], i, last_i, next_i );
+				else last_i = i;
+			}
+		}
+	}
+	for ( Entity *entity = entities, *next; entity!=NULL; entity=next )
+	{
+		next = entity->next;
+		for ( int j=0; j<3; j++ )
+			freeListItem( &entity->as_sub[ j ] );
+		entity->state = -1;
+		if ( !entity->logged )
+			slabFree( &EntityPool, entity );
+	}
 }
 
 void *lookupItem( listItem *list, void *ptr )
@@ -88,15 +291,12 @@ void *lookupItem( listItem *list, void *ptr )
 
 void *newItem( void *ptr )
 {
-        listItem *item;
         if ( freeItemList == NULL )
-                item = calloc( 1, sizeof( listItem ) );
-        else
-        {
-                item = freeItemList;
-                freeItemList = item->next;
-                item->next = NULL;
-        }
+		fill_items();
+        listItem *item = freeItemList;
+        freeItemList = item->next;
+        item->next = NULL;
+	freeItemCount--;
         item->ptr = ptr;
         return item;
 }
@@ -183,6 +383,9 @@ void freeItem( listItem *item )
         item->next = freeItemList;
 	item->ptr = NULL;
         freeItemList = item;
+	if ( !itemCounted ) count_items();
+	if ( ++freeItemCount > ITEM_CACHE )
+		spill_items( ITEM_CACHE / 2 );
 }
 
 listItem *catListItem( listItem *list1, listItem *list2 )
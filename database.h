@@ -15,6 +15,7 @@ typedef struct _Entity
         struct _Entity *sub[3];
 
 	int state;
+	int logged;	// frame log membership - see frame.c
 
 	// memory management
         struct _Entity *next;
@@ -24,6 +25,10 @@ Entity;
 
 Entity *newEntity( Entity *source, Entity *medium, Entity *target );
 void freeEntity( Entity *this );
+void freeEntities( Entity *entities );
+void reclaimEntity( Entity *entity );
+void entityPoolStats( PoolStats *stats );
+long compactEntities( long keep );
 
 void *newItem( void *ptr );
 void *lookupItem( listItem *list, void *ptr );
@@ -37,6 +42,8 @@ listItem *catListItem( listItem *list1, listItem *list2 );
 void popListItem( listItem **item );
 void freeListItem( listItem **item );
 int reorderListItem( listItem **item );
+void itemPoolStats( PoolStats *stats );
+long compactItems( long keep );
 
 
 #endif	// DATABASE_H
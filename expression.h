@@ -14,5 +14,15 @@ _action parse_expression;
 void	freeExpression( Expression *expression );
 void	expression_collapse( Expression *expression );
 int	expression_solve( Expression *expression, int as_sub, _context *context );
+int	explainExpression( Expression *expression, _context *context );
+void	profileExpressions( int on );
+int	profilingExpressions( void );
+void	outputProfile( int top );
+void	resetProfile( void );
+
+Cursor	*openCursor( Expression *expression, int own, _context *context );
+void	*cursorNext( Cursor *cursor );
+void	closeCursor( Cursor *cursor );
+void	drainCursors( _context *context );
 
 #endif	// EXPRESSION_H
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <string.h>
+#include <time.h>
 
 #include "database.h"
 #include "registry.h"
@@ -12,9 +13,13 @@
 #include "expression_util.h"
 #include "filter_util.h"
 #include "variables.h"
+#include "parallel.h"
+#include "output.h"
+#include "trace.h"
 
 // #define DEBUG
 #define MEMOPT
+#define PARALLEL_DB	2048	// minimum database size for concurrent sub solving
 
 #ifdef DEBUG
 #define DEBUG_1	\
@@ -51,6 +56,139 @@ typedef struct {
 	int active;
 } CandidateSub;
 
+/*---------------------------------------------------------------------------
+	explain
+---------------------------------------------------------------------------*/
+/*
+	while explaining, each solve() records the access path it took and
+	what it cost into a node of its own - see explainExpression()
+*/
+typedef struct _ExplainNode {
+	struct _ExplainNode *parent;
+	Expression *expression;
+	int depth;
+	char *scan;		// whole database scan, if any
+	char *path;		// where the search took its candidates from
+	int terms[ 4 ];		// sizes of the terms' results, -1 if unspecified
+				// and 0 if not reached
+	int candidates, rejected, results;
+	struct timespec start;
+	double time;		// in ms, including nested solving
+}
+ExplainNode;
+
+static struct {
+	int on;
+	int depth;
+	listItem *nodes;	// { ExplainNode } in order of solving
+	ExplainNode *current;
+} Explain = { 0, 0, NULL, NULL };
+
+#define EXPLAIN_SCAN( s ) \
+	if (( Explain.current != NULL ) && ( Explain.current->scan == NULL )) Explain.current->scan = s;
+#define EXPLAIN_PATH( p ) \
+	if (( Explain.current != NULL ) && ( Explain.current->path == NULL )) Explain.current->path = p;
+
+static double
+elapsed( struct timespec *start )
+{
+	struct timespec now;
+	clock_gettime( CLOCK_MONOTONIC, &now );
+	return ( now.tv_sec - start->tv_sec ) * 1e3 + ( now.tv_nsec - start->tv_nsec ) / 1e6;
+}
+
+static int
+list_size( listItem *list )
+{
+	int count = 0;
+	for ( listItem *i = list; i!=NULL; i=i->next ) count++;
+	return count;
+}
+
+static ExplainNode *
+explain_begin( Expression *expression )
+{
+	if ( !Explain.on ) return NULL;
+	ExplainNode *node = (ExplainNode *) calloc( 1, sizeof(ExplainNode) );
+	node->parent = Explain.current;
+	node->expression = expression;
+	node->depth = Explain.depth++;
+	ExpressionSub *sub = expression->sub;
+	for ( int i=0; i<4; i++ )
+		node->terms[ i ] = ( sub[ i ].result.none || sub[ i ].result.any ) ? -1 : 0;
+	addItem( &Explain.nodes, node );
+	Explain.current = node;
+	clock_gettime( CLOCK_MONOTONIC, &node->start );
+	return node;
+}
+
+static void
+explain_term( Expression *expression, int count )
+{
+	if ( Explain.current == NULL ) return;
+	Explain.current->terms[ count ] = list_size( expression->sub[ count ].result.list );
+}
+
+static void
+explain_end( ExplainNode *node, listItem *results )
+{
+	if ( node == NULL ) return;
+	node->time = elapsed( &node->start );
+	node->results = list_size( results );
+	Explain.current = node->parent;
+	Explain.depth--;
+}
+
+/*---------------------------------------------------------------------------
+	profile
+---------------------------------------------------------------------------*/
+/*
+	while profiling, every expression solved - interactive queries, loops,
+	narrative conditions and events alike - adds its cost to the entry
+	registered under its textual form, so that the entry accounts for all
+	the expressions which read the same
+*/
+typedef struct {
+	char *text;
+	long calls, candidates, results;
+	double time;	// in ms, including nested solving
+}
+ProfileEntry;
+
+static struct {
+	int on;
+	long candidates;	// candidates visited so far
+	Registry entries;	// { text: ProfileEntry }
+} Profile = { 0, 0, NULL };
+
+static char *
+expression_text( Expression *expression )
+{
+	char *text;
+	size_t len;
+	FILE *stream = open_memstream( &text, &len );
+	FILE *restore = setOutputStream( stream );
+	output_expression( ExpressionAll, expression, -1, -1 );
+	setOutputStream( restore );
+	fclose( stream );
+	return text;
+}
+
+static ProfileEntry *
+profile_entry( Expression *expression )
+{
+	char *text = expression_text( expression );
+	registryEntry *entry = lookupByName( Profile.entries, text );
+	if ( entry != NULL ) {
+		free( text );
+		return (ProfileEntry *) entry->value;
+	}
+	ProfileEntry *profile = (ProfileEntry *) calloc( 1, sizeof(ProfileEntry) );
+	profile->text = text;
+	registerByName( &Profile.entries, text, profile );
+	return profile;
+}
+
 /*---------------------------------------------------------------------------
 	filter_results utilities
 ---------------------------------------------------------------------------*/
@@ -105,7 +243,7 @@ filter_results( listItem **list, Expression *expression, int count, void *instan
 		return;
 	}
 
-	if ( CN.context->expression.mode == ReadMode )
+	if ( currentContext()->expression.mode == ReadMode )
 	{
 		ExpressionSub *s;
 		if ( type == IDENTIFIER )
@@ -135,14 +273,15 @@ filter_results( listItem **list, Expression *expression, int count, void *instan
 				}
 			} else {
 				Expression *expr = cn_expression( entity );
+				_context *context = currentContext();
 				if ( expr != NULL ) s_loop( count, results, &s ) {
-					listItem *restore_filter = CN.context->expression.filter;
+					listItem *restore_filter = context->expression.filter;
 					listItem *filter = newItem( s );
-					CN.context->expression.filter = filter;
-					if ( expression_solve( expr, count, CN.context ) > 0 ) {
+					context->expression.filter = filter;
+					if ( expression_solve( expr, count, context ) > 0 ) {
 						addItem( list, s );
 					}
-					CN.context->expression.filter = restore_filter;
+					context->expression.filter = restore_filter;
 					freeItem( filter );
 				}
 				freeExpression( expr );
@@ -209,21 +348,32 @@ first_candidate( listItem **sub, FlagSub *flag_sub, Expression *expression, list
 #ifdef DEBUG
 	fprintf( stderr, "debug> first_candidate" );
 #endif
-	if ( results != NULL ) return results;
+	if ( results != NULL ) {
+		EXPLAIN_PATH( "filter" )
+		return results;
+	}
 
 	Entity *source = ( sub[0] && !flag_sub[0].not ) ? sub[0]->ptr : NULL;
 	Entity *medium = ( sub[1] && !flag_sub[1].not ) ? sub[1]->ptr : NULL;
 	Entity *target = ( sub[2] && !flag_sub[2].not ) ? sub[2]->ptr : NULL;
 	Entity *instance = ( sub[3] && !flag_sub[3].not ) ? sub[3]->ptr : NULL;
 
-	if ( instance != NULL )
+	if ( instance != NULL ) {
+		EXPLAIN_PATH( "instance term" )
 		return sub[3];
-	if ( target != NULL )
+	}
+	if ( target != NULL ) {
+		EXPLAIN_PATH( "target's as_sub[ 2 ]" )
 		return target->as_sub[2];
-	if ( source != NULL )
+	}
+	if ( source != NULL ) {
+		EXPLAIN_PATH( "source's as_sub[ 0 ]" )
 		return source->as_sub[0];
-	if ( medium != NULL )
+	}
+	if ( medium != NULL ) {
+		EXPLAIN_PATH( "medium's as_sub[ 1 ]" )
 		return medium->as_sub[1];
+	}
 
 	return NULL;
 }
@@ -231,7 +381,7 @@ first_candidate( listItem **sub, FlagSub *flag_sub, Expression *expression, list
 static int
 set_candidate_sub( CandidateSub *sub, int as_sub, listItem *candidate )
 {
-	if ( CN.context->expression.mode == ReadMode )
+	if ( currentContext()->expression.mode == ReadMode )
 	{
 		ExpressionSub *entity = (ExpressionSub *) candidate->ptr;
 		sub[ 3 ].ptr = entity;
@@ -274,13 +424,234 @@ set_candidate_sub( CandidateSub *sub, int as_sub, listItem *candidate )
 	return 1;
 }
 
+/*---------------------------------------------------------------------------
+	search
+---------------------------------------------------------------------------*/
+#define SEARCH	2
+
+typedef struct {
+	Expression *expression;
+	int as_sub;
+	listItem *results;
+	FlagSub flag_sub[ 4 ];
+	listItem *sub_list[ 4 ], *candidate;
+	void *r_sub[ 4 ];
+}
+Search;
+
+static int
+search_init( Search *search )
+/*
+	positions search on its first candidate - returns 0 if there is none
+*/
+{
+	Expression *expression = search->expression;
+	listItem **sub_list = search->sub_list;
+	void **r_sub = search->r_sub;
+	for ( int i=0; i<4; i++ ) {
+		r_sub[ i ] = sub_init( sub_list, i, expression );
+	}
+	DEBUG_2;
+	search->candidate = first_candidate( sub_list, search->flag_sub, expression, search->results );
+#ifdef DEBUG
+	if ( search->candidate == NULL )
+		fprintf( stderr, " - NULL candidate\n" );
+	else
+		fprintf( stderr, " - %0x\n", (int) search->candidate->ptr );
+#endif
+	return ( search->candidate != NULL );
+}
+
+static int
+search_take( Search *search )
+{
+	FlagSub *flag_sub = search->flag_sub;
+	void **r_sub = search->r_sub;
+	CandidateSub c_sub[ 4 ];
+
+	int take = set_candidate_sub( c_sub, search->as_sub, search->candidate );
+	if ( Explain.current != NULL ) Explain.current->candidates++;
+	if ( Profile.on ) Profile.candidates++;
+	for ( int i=0; take && ( i < 4 ); i++ )
+	{
+		if ( ( flag_sub[ i ].active && !c_sub[ i ].active ) ||
+		     ( flag_sub[ i ].inactive && c_sub[ i ].active ) ||
+		     ( flag_sub[ i ].any ? 0 : flag_sub[ i ].not ?
+			( c_sub[ i ].ptr == r_sub[ i ] ) : ( c_sub[ i ].ptr != r_sub[i] ) )
+		     )
+		{
+			take = 0;
+		}
+	}
+	if ( !take && ( Explain.current != NULL )) Explain.current->rejected++;
+#ifdef DEBUG
+	if ( take ) fprintf( stderr, "debug> solver: good one\n" );
+	else fprintf( stderr, "debug> solver: wrong candidate\n" );
+#endif
+	return take;
+}
+
+static void
+search_advance( Search *search )
+/*
+	moves search on to its next candidate, which is NULL past the last one
+*/
+{
+	Expression *expression = search->expression;
+	listItem **sub_list = search->sub_list;
+	void **r_sub = search->r_sub;
+
+	if ( search->candidate->next != NULL ) {
+		search->candidate = search->candidate->next;
+		return;
+	}
+	do {
+		if (( r_sub[3] = sub_next( sub_list, 3 ) )) {
+			;
+		} else if (( r_sub[2] = sub_next( sub_list, 2 ) )) {
+			r_sub[3] = sub_init( sub_list, 3, expression );
+		} else if (( r_sub[1] = sub_next( sub_list, 1 ) )) {
+			r_sub[2] = sub_init( sub_list, 2, expression );
+			r_sub[3] = sub_init( sub_list, 3, expression );
+		} else if (( r_sub[0] = sub_next( sub_list, 0 ) )) {
+			r_sub[1] = sub_init( sub_list, 1, expression );
+			r_sub[2] = sub_init( sub_list, 2, expression );
+			r_sub[3] = sub_init( sub_list, 3, expression );
+		}
+		else {
+#ifdef DEBUG
+			fprintf( stderr, "debug> solver: search exhausted\n" );
+#endif
+			search->candidate = NULL;
+			return;
+		}
+		search->candidate = first_candidate( sub_list, search->flag_sub, expression, search->results );
+	}
+	while( search->candidate == NULL );
+}
+
+static void *
+search_next( Search *search )
+/*
+	returns the next candidate taken, or NULL once search is exhausted
+*/
+{
+	while ( search->candidate != NULL ) {
+		void *ptr = search->candidate->ptr;
+		int take = search_take( search );
+		search_advance( search );
+		if ( take ) return ptr;
+	}
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------
+	solve_in_parallel
+---------------------------------------------------------------------------*/
+static int solve( Expression *expression, int as_sub, listItem *results, int exist );
+
+static int
+independent( Expression *expression )
+/*
+	returns true if expression can be solved without accessing any state
+	other than its own nodes and the database - i.e. holds no variables
+	and no incomplete terms
+*/
+{
+	ExpressionSub *sub = expression->sub;
+	for ( int i=0; i<4; i++ ) {
+		if ( sub[ i ].result.none || sub[ i ].result.any )
+			continue;
+		if ( sub[ i ].result.identifier.type == VariableIdentifier )
+			return 0;
+		if ( sub[ i ].result.identifier.value != NULL )
+			continue;
+		if ( sub[ i ].result.identifier.type == NullIdentifier )
+			continue;
+		if (( sub[ i ].e == NULL ) || !independent( sub[ i ].e ))
+			return 0;
+	}
+	return 1;
+}
+
+typedef struct {
+	Expression *expression;
+	int count[ 4 ], n;
+	int success[ 4 ];
+} SolveVA;
+
+static void
+solve_sub( void *data, int index )
+{
+	SolveVA *va = (SolveVA *) data;
+	ExpressionSub *sub = va->expression->sub;
+	int count = va->count[ index ];
+	int sub_count = sub[ 1 ].result.none ? 3 : count;
+	va->success[ count ] = solve( sub[ count ].e, sub_count, NULL, 0 );
+}
+
+static int
+solve_in_parallel( Expression *expression, int *solved, int *success, listItem *results )
+/*
+	pre-solves the bracketed sub-expressions of expression concurrently,
+	provided there are at least two of them, that they are independent
+	and the database large enough to be worth it. Each task's scratch
+	state is its own sub-expression's result lists; solve() then joins
+	these in the order it would have computed them. Note that all of them
+	are solved, whereas solve() would have stopped at the first without
+	results - the price of solving them at the same time.
+	Returns the number of sub-expressions solved.
+*/
+{
+	if (( results != NULL ) || ( currentContext()->expression.mode != EvaluateMode ) ||
+	    Explain.on || Profile.on || ( parallel_workers() == 0 ))
+		return 0;
+
+	ExpressionSub *sub = expression->sub;
+	SolveVA va;
+	va.expression = expression;
+	va.n = 0;
+	for ( int count=0; count<4; count++ ) {
+		if ( sub[ count ].result.none || sub[ count ].result.any ||
+		     ( sub[ count ].result.identifier.type == VariableIdentifier ) ||
+		     ( sub[ count ].result.identifier.type == NullIdentifier ) ||
+		     ( sub[ count ].result.identifier.value != NULL ) ||
+		     ( sub[ count ].e == NULL ) || !independent( sub[ count ].e ))
+			continue;
+		va.count[ va.n++ ] = count;
+	}
+	if ( va.n < 2 )
+		return 0;
+
+	PoolStats entities;
+	entityPoolStats( &entities );
+	if ( entities.live < PARALLEL_DB )
+		return 0;
+
+#ifdef DEBUG
+	fprintf( stderr, "debug> solve_in_parallel: %d sub-expressions\n", va.n );
+#endif
+	parallel_for( va.n, solve_sub, &va );
+	for ( int i=0; i<va.n; i++ ) {
+		int count = va.count[ i ];
+		solved[ count ] = 1;
+		success[ count ] = va.success[ count ];
+	}
+	return va.n;
+}
+
 /*---------------------------------------------------------------------------
 	solve
 ---------------------------------------------------------------------------*/
 static int
-solve( Expression *expression, int as_sub, listItem *results )
+solve_terms( Expression *expression, int as_sub, listItem *results, int exist, Search *search )
+/*
+	solves expression's terms - i.e. steps 1. to 3. below. Returns SEARCH
+	if expression's results remain to be searched, in which case search
+	is set up accordingly, or else returns solve()'s return value.
+*/
 {
-	_context *context = CN.context;
+	_context *context = currentContext();
 	ExpressionSub *sub = expression->sub;
 
 #ifdef DEBUG
@@ -289,6 +660,9 @@ solve( Expression *expression, int as_sub, listItem *results )
 
 	// 1. fill in sub results
 	// ----------------------
+	int solved[ 4 ] = { 0, 0, 0, 0 }, solved_success[ 4 ];
+	solve_in_parallel( expression, solved, solved_success, results );
+
 	for ( int count=0; count<4; count++ )
 	{
 		if ( sub[ count ].result.none || sub[ count ].result.any ) {
@@ -447,8 +821,14 @@ solve( Expression *expression, int as_sub, listItem *results )
 #endif
 
 				Expression *e = sub[ count ].e;
+				if ( solved[ count ] ) {
+					if ( solved_success[ count ] <= 0 ) return solved_success[ count ];
+					*sub_results = e->result.list;
+					e->result.list = NULL;
+					break;
+				}
 				int sub_count = sub[ 1 ].result.none ? 3 : count;
-				int success = solve( e, sub_count, *sub_results );
+				int success = solve( e, sub_count, *sub_results, 0 );
 #ifdef MEMOPT
 				if (( count != 3 ) && ( !sub[ 1 ].result.none ))
 #endif
@@ -465,6 +845,7 @@ solve( Expression *expression, int as_sub, listItem *results )
 			}
 			break;
 		}
+		explain_term( expression, count );
 	}
 
 	if ( context->expression.mode == InstantiateMode )
@@ -491,6 +872,8 @@ solve( Expression *expression, int as_sub, listItem *results )
 			}
 			addItem( &expression->result.list, e );
 		}
+		for ( int i=0; i<3; i++ )
+			freeListItem( &sub[ i ].result.list );
 		return 1;
 	}
 
@@ -508,8 +891,10 @@ solve( Expression *expression, int as_sub, listItem *results )
 				return 1;
 			}
 			else if ( sub[ 0 ].result.not ) {
-				invert_results( &sub[ 0 ], as_sub, results );
+				EXPLAIN_SCAN( ( results == NULL ) ? "inverted over CN.DB" : "inverted over filter" )
+				invert_results( &sub[ 0 ], as_sub, results, exist );
 			} else {
+				EXPLAIN_PATH( "term results" )
 				take_sub_results( &sub[ 0 ], as_sub );
 			}
 			expression->result.list = sub[ 0 ].result.list;
@@ -518,13 +903,16 @@ solve( Expression *expression, int as_sub, listItem *results )
 		else if ( sub[ 0 ].result.none || sub[ 0 ].result.any )
 		{
 			if ( sub[ 3 ].result.not ) {
-				invert_results( &sub[ 3 ], as_sub, results );
+				EXPLAIN_SCAN( ( results == NULL ) ? "inverted over CN.DB" : "inverted over filter" )
+				invert_results( &sub[ 3 ], as_sub, results, exist );
 			} else {
+				EXPLAIN_PATH( "term results" )
 				take_sub_results( &sub[ 3 ], as_sub );
 			}
 			expression->result.list = sub[ 3 ].result.list;
 			sub[ 3 ].result.list = NULL;
 		} else {
+			EXPLAIN_PATH( "term results" )
 			extract_sub_results( &sub[ 0 ], &sub[ 3 ], as_sub, results );
 			expression->result.list = sub[ 0 ].result.list;
 			sub[ 0 ].result.list = NULL;
@@ -537,7 +925,7 @@ solve( Expression *expression, int as_sub, listItem *results )
 #ifdef DEBUG
 	fprintf( stderr, "debug> solver: 2. checking terms completion..\n" );
 #endif
-	FlagSub flag_sub[ 4 ];
+	FlagSub *flag_sub = search->flag_sub;
 	for ( int i=0; i<4; i++ ) {
 		flag_sub[ i ].active = sub[ i ].result.active;
 		flag_sub[ i ].inactive = sub[ i ].result.inactive;
@@ -579,7 +967,8 @@ solve( Expression *expression, int as_sub, listItem *results )
 			fprintf( stderr, "debug> solver: 3.1. special case - inverting all %d\n", count );
 #endif
 			int sub_count = ( count < 3 ) ? ( 1 << count ) : as_sub;
-			invert_results( &sub[ count ], sub_count, NULL );
+			EXPLAIN_SCAN( "inverted over CN.DB" )
+			invert_results( &sub[ count ], sub_count, NULL, 0 );
 			flag_sub[ count ].not = 0;
 		}
 		else	// special cases: [ .-.->. : . ] aka. [ ... ], .-.->[ ..? ] etc.
@@ -592,90 +981,47 @@ solve( Expression *expression, int as_sub, listItem *results )
 				( expression->result.mark == 4 ) ? 2 : 3;
 
 			int sub_count = ( count < 3 ) ? ( 1 << count ) : as_sub;
-			listItem *list = take_all( expression, as_sub, NULL );
+			EXPLAIN_SCAN( "taken over CN.DB" )
+			listItem *list = take_all( expression, as_sub, NULL, 0 );
 			sub[ count ].result.list = list;
 		}
 	}
 
-	// 4. generate own list of results
-	// -------------------------------
-	listItem *sub_list[4], *candidate;
+	search->expression = expression;
+	search->as_sub = as_sub;
+	search->results = results;
+	return SEARCH;
+}
 
-#ifdef DEBUG
-	fprintf( stderr, "debug> solver: 4. searching...\n" );
-#endif
-	// initiate loop
-	void *r_sub[ 4 ];
-	for ( int i=0; i<4; i++ ) {
-		r_sub[ i ] = sub_init( sub_list, i, expression );
-	}
-	DEBUG_2;
-	candidate = first_candidate( sub_list, flag_sub, expression, results );
-	if ( candidate == NULL ) {
-#ifdef DEBUG
-		fprintf( stderr, " - NULL candidate\n" );
-#endif
-		return 0;
+static int
+solve( Expression *expression, int as_sub, listItem *results, int exist )
+/*
+	if exist is set, expression's results only matter in that there are
+	some, and solve() stops at the first one found. Sub-expressions are
+	always solved in full, as their results are the candidates' terms.
+*/
+{
+	Search search;
+	ExplainNode *node = explain_begin( expression );
+	int success = solve_terms( expression, as_sub, results, exist, &search );
+	if ( success != SEARCH ) {
+		explain_end( node, expression->result.list );
+		return success;
 	}
-#ifdef DEBUG
-	fprintf( stderr, " - %0x\n", (int) candidate->ptr );
-#endif
-	// execute loop
-	for ( ; ; ) {
 
-		CandidateSub c_sub[ 4 ];
-
-		int take = set_candidate_sub( c_sub, as_sub, candidate );
-		for ( int i=0; take && ( i < 4 ); i++ )
-		{
-			if ( ( flag_sub[ i ].active && !c_sub[ i ].active ) ||
-			     ( flag_sub[ i ].inactive && c_sub[ i ].active ) ||
-			     ( flag_sub[ i ].any ? 0 : flag_sub[ i ].not ?
-				( c_sub[ i ].ptr == r_sub[ i ] ) : ( c_sub[ i ].ptr != r_sub[i] ) )
-			     )
-			{
-				take = 0;
-			}
-		}
-		if ( !take ) {
-#ifdef DEBUG
-			fprintf( stderr, "debug> solver: wrong candidate\n" );
-#endif
-			; // wrong candidate
-		}
-		else {
-#ifdef DEBUG
-			fprintf( stderr, "debug> solver: good one - calling addIfNotThere\n" );
-#endif
-			addIfNotThere( &expression->result.list, candidate->ptr ); // eliminates doublons
-		}
-
-		if ( candidate->next != NULL ) {
-			candidate = candidate->next;
-		}
-		else do {
-			if (( r_sub[3] = sub_next( sub_list, 3 ) )) {
-				;
-			} else if (( r_sub[2] = sub_next( sub_list, 2 ) )) {
-				r_sub[3] = sub_init( sub_list, 3, expression );
-			} else if (( r_sub[1] = sub_next( sub_list, 1 ) )) {
-				r_sub[2] = sub_init( sub_list, 2, expression );
-				r_sub[3] = sub_init( sub_list, 3, expression );
-			} else if (( r_sub[0] = sub_next( sub_list, 0 ) )) {
-				r_sub[1] = sub_init( sub_list, 1, expression );
-				r_sub[2] = sub_init( sub_list, 2, expression );
-				r_sub[3] = sub_init( sub_list, 3, expression );
-			}
-			else {
+	// 4. generate own list of results
+	// -------------------------------
 #ifdef DEBUG
-				fprintf( stderr, "debug> solver: returning\n" );
+	fprintf( stderr, "debug> solver: 4. searching...\n" );
 #endif
-				return ( expression->result.list == NULL ) ? 0 : 1;
-			}
-			candidate = first_candidate( sub_list, flag_sub, expression, results );
+	if ( search_init( &search ) ) {
+		for ( void *ptr; ( ptr = search_next( &search ) ); ) {
+			addIfNotThere( &expression->result.list, ptr ); // eliminates doublons
+			if ( exist ) break;
 		}
-		while( candidate == NULL );
 	}
+	explain_end( node, expression->result.list );
+	return ( expression->result.list == NULL ) ? 0 : 1;
 }
 
 /*---------------------------------------------------------------------------
@@ -689,7 +1035,7 @@ solve( Expression *expression, int as_sub, listItem *results )
 static void
 extract_final_results( listItem **list, Expression *expression, int count, listItem *results )
 {
-	if ( CN.context->expression.mode == ReadMode )
+	if ( currentContext()->expression.mode == ReadMode )
 	{
 		ExpressionSub *s;
 		s_loop( count, results, &s ) {
@@ -708,7 +1054,7 @@ extract_final_results( listItem **list, Expression *expression, int count, listI
 static int
 resolve( Expression *expression )
 {
-	_context *context = CN.context;
+	_context *context = currentContext();
 	if ( expression->result.list == NULL )
 		return 0;
 
@@ -823,15 +1169,57 @@ cleanup_results( Expression *expression )
 	freeListItem( &expression->result.list );
 }
 
+static void drain_cursor( Expression *expression, _context *context );
+
+static int solve_expression( Expression *expression, int as_sub, _context *context );
+
 int
 expression_solve( Expression *expression, int as_sub, _context *context )
+/*
+	if context->expression.exist is set - it is reset here, so as not to
+	apply to nested expressions - the caller only needs to know whether
+	there are any results, and in EvaluateMode the search stops at the
+	first one found.
+*/
+{
+	long trace = traceClock();
+	if (( !Profile.on && !trace ) || ( expression == NULL ))
+		return solve_expression( expression, as_sub, context );
+
+	struct timespec start;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	long candidates = Profile.candidates;
+	int success = solve_expression( expression, as_sub, context );
+	double time = elapsed( &start );
+
+	if ( trace ) {
+		char *text = expression_text( expression );
+		traceSpan( "expression", "expression_solve", trace, text );
+		free( text );
+	}
+	if ( !Profile.on )
+		return success;
+	ProfileEntry *profile = profile_entry( expression );
+	profile->calls++;
+	profile->time += time;
+	profile->candidates += Profile.candidates - candidates;
+	if ( success > 0 )
+		profile->results += list_size( context->expression.results );
+	return success;
+}
+
+static int
+solve_expression( Expression *expression, int as_sub, _context *context )
 {
 	int success;
 #ifdef DEBUG
 	fprintf( stderr, "debug> entering expression_solve: %0x...\n", (int) expression );
 #endif
 	freeListItem( &context->expression.results );
+	int exist = context->expression.exist;
+	context->expression.exist = 0;
 	if ( expression == NULL ) return 0;
+	drain_cursor( expression, context );
 
 	int restore_mode = context->expression.mode;
 	switch ( restore_mode ) {
@@ -856,6 +1244,7 @@ expression_solve( Expression *expression, int as_sub, _context *context )
 		return 0;
 	}
 	int filter_on = ( context->expression.mode == ReadMode );
+	exist = exist && ( context->expression.mode == EvaluateMode );
 
 #ifdef DEBUG
 	if ( filter_on ) fprintf( stderr, "debug> expression_solve: filter on\n" );
@@ -879,7 +1268,10 @@ expression_solve( Expression *expression, int as_sub, _context *context )
 		fprintf( stderr, "debug> going to take_all - as_sub: %d\n", as_sub );
 #endif
 		as_sub = expression->result.as_sub | ( 1  <<  as_sub );
-		expression->result.list = take_all( expression, as_sub, context->expression.filter );
+		ExplainNode *node = explain_begin( expression );
+		EXPLAIN_SCAN( ( context->expression.filter == NULL ) ? "taken over CN.DB" : "taken over filter" )
+		expression->result.list = take_all( expression, as_sub, context->expression.filter, exist );
+		explain_end( node, expression->result.list );
 		int count =
 			( expression->result.mark == 1 ) ? 0 :
 			( expression->result.mark == 2 ) ? 1 :
@@ -893,7 +1285,7 @@ expression_solve( Expression *expression, int as_sub, _context *context )
 	}
 	else
 	{
-		success = solve( expression, as_sub, context->expression.filter );
+		success = solve( expression, as_sub, context->expression.filter, exist );
 		if (( success > 0 ) && filter_on ) {
 			success = rebuild_filtered_results( &expression->result.list, context );
 		}
@@ -922,3 +1314,324 @@ expression_solve( Expression *expression, int as_sub, _context *context )
 	return success;
 }
 
+/*---------------------------------------------------------------------------
+	cursors
+---------------------------------------------------------------------------*/
+/*
+	A cursor yields an expression's results one at a time, straight from
+	the solver's search loop, so that these never need to be held all at
+	once. Results come in search order, rather than in the address order
+	of expression_solve() - which is why cursors are only offered through
+	the API, see cn_cursor(), the command language's output and loops
+	keeping to address order. As the search walks the database as it is, any
+	change to the database - and any other solving of the same expression
+	- first drains the open cursors, i.e. completes their results as they
+	were. The cases which the search loop does not cover - filters, marks
+	and the like - are solved in full upon opening.
+*/
+struct _Cursor {
+	Search search;		// search.expression is NULL once done searching
+	Expression *owned;	// freed upon closing
+	listItem *list;		// results remaining, once done searching
+	listItem *seen;		// results yielded, if the search may repeat them
+	ProfileEntry *profile;	// while profiling
+	unsigned int repeats : 1;
+};
+
+static int
+streamable( Expression *expression, _context *context )
+{
+	if (( context->expression.mode != EvaluateMode ) || expression->result.marked ||
+	    ( context->expression.filter != NULL ) || ( context->expression.filter_identifier != NULL ))
+		return 0;
+	if ( lookupItem( context->expression.stack, expression ) != NULL )
+		return 0;	// let expression_solve() report the recursion
+	ExpressionSub *sub = expression->sub;
+	for ( int i=0; i<4; i++ )
+		if ( !sub[ i ].result.any && !sub[ i ].result.none )
+			return 1;
+	return 0;	// take_all() case
+}
+
+static void
+cursor_done( Cursor *cursor, _context *context )
+{
+	cleanup_results( cursor->search.expression );
+	cursor->search.expression = NULL;
+	freeListItem( &cursor->seen );
+	removeItem( &context->expression.cursors, cursor );
+}
+
+static void
+cursor_drain( Cursor *cursor )
+{
+	ExplainNode *current = Explain.current;
+	Explain.current = NULL;
+	listItem *list = NULL;
+	while ( cursor->search.expression != NULL ) {
+		void *ptr = cursorNext( cursor );
+		if ( ptr != NULL ) addItem( &list, ptr );
+	}
+	reorderListItem( &list );
+	cursor->list = list;
+	Explain.current = current;
+}
+
+static void
+drain_cursor( Expression *expression, _context *context )
+{
+	for ( listItem *i = context->expression.cursors; i!=NULL; i=i->next ) {
+		Cursor *cursor = (Cursor *) i->ptr;
+		if ( cursor->search.expression == expression ) {
+			cursor_drain( cursor );
+			return;
+		}
+	}
+}
+
+void
+drainCursors( _context *context )
+/*
+	to be called prior to any change to the database
+*/
+{
+	while ( context->expression.cursors != NULL )
+		cursor_drain( (Cursor *) context->expression.cursors->ptr );
+}
+
+Cursor *
+openCursor( Expression *expression, int own, _context *context )
+/*
+	returns a cursor on expression's results, or NULL on error. If own is
+	set, the cursor takes ownership of expression, which closeCursor() will
+	then free.
+*/
+{
+	Cursor *cursor = (Cursor *) calloc( 1, sizeof(Cursor) );
+	cursor->owned = own ? expression : NULL;
+	if (( expression == NULL ) || !streamable( expression, context )) {
+		int success = expression_solve( expression, 3, context );
+		cursor->list = context->expression.results;
+		context->expression.results = NULL;
+		if ( success < 0 ) {
+			closeCursor( cursor );
+			return NULL;
+		}
+		return cursor;
+	}
+#ifdef DEBUG
+	fprintf( stderr, "debug> openCursor: streaming %0x\n", (int) expression );
+#endif
+	freeListItem( &context->expression.results );
+	context->expression.exist = 0;
+	drain_cursor( expression, context );
+
+	struct timespec start;
+	long candidates = Profile.candidates;
+	if ( Profile.on ) {
+		clock_gettime( CLOCK_MONOTONIC, &start );
+		cursor->profile = profile_entry( expression );
+		cursor->profile->calls++;
+	}
+	addItem( &context->expression.stack, expression );
+	setup_results( expression );
+	int success = solve_terms( expression, 3, NULL, 0, &cursor->search );
+	popListItem( &context->expression.stack );
+	if (( success == SEARCH ) && !search_init( &cursor->search ))
+		success = 0;
+	if ( cursor->profile != NULL ) {
+		cursor->profile->time += elapsed( &start );
+		cursor->profile->candidates += Profile.candidates - candidates;
+		if (( success > 0 ) && ( success != SEARCH ))
+			cursor->profile->results += list_size( expression->result.list );
+	}
+
+	if ( success == SEARCH ) {
+		for ( int i=0; i<4; i++ ) {
+			listItem *list = expression->sub[ i ].result.list;
+			if ( cursor->search.flag_sub[ i ].not && ( list != NULL ) && ( list->next != NULL ))
+				cursor->repeats = 1;
+		}
+		addItem( &context->expression.cursors, cursor );
+		return cursor;
+	}
+	cursor->search.expression = NULL;
+	if ( success > 0 ) {
+		cursor->list = expression->result.list;
+		expression->result.list = NULL;
+	}
+	cleanup_results( expression );
+	if ( success < 0 ) {
+		closeCursor( cursor );
+		return NULL;
+	}
+	return cursor;
+}
+
+void *
+cursorNext( Cursor *cursor )
+/*
+	returns the cursor's next result, or NULL once these are exhausted
+*/
+{
+	if ( cursor == NULL )
+		return NULL;
+	if ( cursor->search.expression == NULL ) {
+		if ( cursor->list == NULL ) return NULL;
+		void *ptr = cursor->list->ptr;
+		popListItem( &cursor->list );
+		return ptr;
+	}
+	_context *context = currentContext();
+	ProfileEntry *profile = Profile.on ? cursor->profile : NULL;
+	struct timespec start;
+	long candidates = Profile.candidates;
+	if ( profile != NULL ) clock_gettime( CLOCK_MONOTONIC, &start );
+
+	int restore_mode = context->expression.mode;
+	context->expression.mode = EvaluateMode;
+	void *ptr;
+	do ptr = search_next( &cursor->search );
+	while (( ptr != NULL ) && cursor->repeats && ( addIfNotThere( &cursor->seen, ptr ) == NULL ));
+	context->expression.mode = restore_mode;
+
+	if ( profile != NULL ) {
+		profile->time += elapsed( &start );
+		profile->candidates += Profile.candidates - candidates;
+		if ( ptr != NULL ) profile->results++;
+	}
+
+	if ( ptr == NULL ) cursor_done( cursor, context );
+	return ptr;
+}
+
+void
+closeCursor( Cursor *cursor )
+{
+	if ( cursor == NULL )
+		return;
+	if ( cursor->search.expression != NULL )
+		cursor_done( cursor, CN.context );
+	freeListItem( &cursor->list );
+	freeExpression( cursor->owned );
+	free( cursor );
+}
+
+/*---------------------------------------------------------------------------
+	explainExpression
+---------------------------------------------------------------------------*/
+static void
+explain_output( ExplainNode *node )
+{
+	printf( "%*s", 2 * ( node->depth + 1 ), "" );
+	output_expression( ExpressionAll, node->expression, -1, -1 );
+	printf( "\n%*s  terms:", 2 * ( node->depth + 1 ), "" );
+	for ( int i=0; i<4; i++ ) {
+		if ( node->terms[ i ] < 0 ) printf( " -" );
+		else printf( " %d", node->terms[ i ] );
+	}
+	if ( node->scan != NULL )
+		printf( ", %s", node->scan );
+	if ( node->path != NULL )
+		printf( ", candidates from %s: %d visited, %d rejected",
+			node->path, node->candidates, node->rejected );
+	printf( ", results: %d, time: %.3fms\n", node->results, node->time );
+}
+
+int
+explainExpression( Expression *expression, _context *context )
+/*
+	solves expression as expression_solve() would, and outputs, for each
+	node solved - in order, and indented by depth - the sizes of its terms'
+	results, whether the node had to scan the whole database, where its
+	search took its candidates from and how many of these it went through,
+	its number of results and the time spent, nested solving included.
+	Nodes solved in the course of resolving variables are listed as well.
+*/
+{
+	Explain.on = 1;
+	struct timespec start;
+	clock_gettime( CLOCK_MONOTONIC, &start );
+	int success = expression_solve( expression, 3, context );
+	double time = elapsed( &start );
+	Explain.on = 0;
+	Explain.current = NULL;
+	Explain.depth = 0;
+
+	reorderListItem( &Explain.nodes );
+	printf( "explain: " );
+	output_expression( ExpressionAll, expression, -1, -1 );
+	printf( "\n" );
+	for ( listItem *i = Explain.nodes; i!=NULL; i=i->next ) {
+		explain_output( (ExplainNode *) i->ptr );
+		free( i->ptr );
+	}
+	freeListItem( &Explain.nodes );
+	printf( "results: %d, time: %.3fms\n",
+		( success > 0 ) ? list_size( context->expression.results ) : 0, time );
+	return success;
+}
+
+/*---------------------------------------------------------------------------
+	profile utilities
+---------------------------------------------------------------------------*/
+void
+profileExpressions( int on )
+{
+	Profile.on = on;
+}
+
+int
+profilingExpressions( void )
+{
+	return Profile.on;
+}
+
+void
+resetProfile( void )
+{
+	for ( listItem *i = CN.context->expression.cursors; i!=NULL; i=i->next )
+		((Cursor *) i->ptr )->profile = NULL;
+	for ( registryEntry *r = Profile.entries; r!=NULL; r=r->next ) {
+		ProfileEntry *profile = (ProfileEntry *) r->value;
+		free( profile->text );
+		free( profile );
+	}
+	freeRegistry( &Profile.entries );
+}
+
+static int
+by_time( const void *a, const void *b )
+{
+	double ta = (*(ProfileEntry **) a)->time;
+	double tb = (*(ProfileEntry **) b)->time;
+	return ( ta < tb ) ? 1 : ( ta > tb ) ? -1 : 0;
+}
+
+void
+outputProfile( int top )
+/*
+	lists the top expressions profiled by cumulative time - all of them if
+	top is 0
+*/
+{
+	int count = 0;
+	for ( registryEntry *r = Profile.entries; r!=NULL; r=r->next ) count++;
+	ProfileEntry **array = (ProfileEntry **) malloc( ( count + 1 ) * sizeof(ProfileEntry *) );
+	count = 0;
+	for ( registryEntry *r = Profile.entries; r!=NULL; r=r->next )
+		array[ count++ ] = (ProfileEntry *) r->value;
+	qsort( array, count, sizeof(ProfileEntry *), by_time );
+
+	if (( top <= 0 ) || ( top > count )) top = count;
+	printf( "profile: %d expression%s%s\n", count, ( count == 1 ) ? "" : "s",
+		Profile.on ? "" : " - profiling is off" );
+	if ( top > 0 )
+		printf( "%10s %12s %12s %10s  expression\n", "calls", "time(ms)", "candidates", "results" );
+	for ( int i=0; i<top; i++ ) {
+		ProfileEntry *profile = array[ i ];
+		printf( "%10ld %12.3f %12ld %10ld  %s\n", profile->calls, profile->time,
+			profile->candidates, profile->results, profile->text );
+	}
+	free( array );
+}
@@ -11,6 +11,7 @@
 #include "expression.h"
 #include "variables.h"
 #include "expression_util.h"
+#include "parallel.h"
 
 // #define DEBUG
 
@@ -402,17 +403,147 @@ test_as_sub( Entity *e, int as_sub )
 	return 1;
 }
 
+/*---------------------------------------------------------------------------
+	scan	- parallel
+---------------------------------------------------------------------------*/
+#define SCAN_CHUNK	2048
+
+typedef void *_scan( void *ptr, void *data );
+
+typedef struct {
+	_scan *test;
+	void *data;
+	listItem **start;
+	int *size;
+	void ***found;
+	int *count;
+}
+ScanVA;
+
+static void
+scan_chunk( void *data, int index )
+{
+	ScanVA *scan = (ScanVA *) data;
+	void **found = (void **) malloc( scan->size[ index ] * sizeof(void *) );
+	int count = 0;
+	listItem *i = scan->start[ index ];
+	for ( int n=0; n<scan->size[ index ]; n++, i=i->next ) {
+		void *ptr = scan->test( i->ptr, scan->data );
+		if ( ptr != NULL ) found[ count++ ] = ptr;
+	}
+	scan->found[ index ] = found;
+	scan->count[ index ] = count;
+}
+
+static listItem *
+scan( listItem *all, _scan *test, void *data, int unique )
+/*
+	returns the list of non-null test( i->ptr, data ) over all, built as
+	the sequential loop would, i.e. using addIfNotThere() if unique is set,
+	and addItem() otherwise. Long lists are split into chunks which are
+	tested across the worker pool - test must be read-only - and the
+	per-chunk partial results merged in order.
+*/
+{
+	listItem *dest = NULL;
+	int chunks = 0;
+	if ( parallel_workers() > 0 ) {
+		int n = 0;
+		for ( listItem *i = all; i!=NULL; i=i->next ) n++;
+		chunks = ( n + SCAN_CHUNK - 1 ) / SCAN_CHUNK;
+	}
+	if ( chunks < 2 ) {
+		for ( listItem *i = all; i!=NULL; i=i->next ) {
+			void *ptr = test( i->ptr, data );
+			if ( ptr == NULL ) continue;
+			if ( unique ) addIfNotThere( &dest, ptr );
+			else addItem( &dest, ptr );
+		}
+		return dest;
+	}
+
+	ScanVA va;
+	va.test = test;
+	va.data = data;
+	va.start = (listItem **) malloc( chunks * sizeof(listItem *) );
+	va.size = (int *) malloc( chunks * sizeof(int) );
+	va.found = (void ***) malloc( chunks * sizeof(void **) );
+	va.count = (int *) malloc( chunks * sizeof(int) );
+	int n = 0;
+	for ( listItem *i = all; i!=NULL; i=i->next, n++ ) {
+		if ( n % SCAN_CHUNK == 0 ) {
+			va.start[ n / SCAN_CHUNK ] = i;
+			va.size[ n / SCAN_CHUNK ] = 0;
+		}
+		va.size[ n / SCAN_CHUNK ]++;
+	}
+
+	parallel_for( chunks, scan_chunk, &va );
+
+	for ( int c=0; c<chunks; c++ ) {
+		for ( int j=0; j<va.count[ c ]; j++ ) {
+			if ( unique ) addIfNotThere( &dest, va.found[ c ][ j ] );
+			else addItem( &dest, va.found[ c ][ j ] );
+		}
+		free( va.found[ c ] );
+	}
+	free( va.start );
+	free( va.size );
+	free( va.found );
+	free( va.count );
+	return dest;
+}
+
+static listItem *
+scan_first( listItem *all, _scan *test, void *data )
+/*
+	returns the first non-null test( i->ptr, data ) over all, as a single
+	item list - for existence tests, where the scan can stop right there
+*/
+{
+	for ( listItem *i = all; i!=NULL; i=i->next ) {
+		void *ptr = test( i->ptr, data );
+		if ( ptr != NULL ) return newItem( ptr );
+	}
+	return NULL;
+}
+
 /*---------------------------------------------------------------------------
 	invert_results
 ---------------------------------------------------------------------------*/
+typedef struct {
+	int as_sub, active, inactive;
+	listItem *source;
+}
+InvertVA;
+
+static void *
+invert_test( void *ptr, void *data )
+{
+	InvertVA *va = (InvertVA *) data;
+	Entity *e = (Entity *) ptr;
+
+	if ( !test_as_sub( e, va->as_sub ) )
+		return NULL;
+	if (( va->active && !cn_is_active(e) ) ||
+	    ( va->inactive && cn_is_active(e) ) )
+		return NULL;
+	if ( lookupItem( va->source, e ) != NULL )
+		return NULL;
+	return e;
+}
+
 void
-invert_results( ExpressionSub *sub, int as_sub, listItem *results )
+invert_results( ExpressionSub *sub, int as_sub, listItem *results, int exist )
+/*
+	if exist is set, stops at the first result found
+*/
 {
 	listItem *source = sub->result.list;
 	listItem *dest = NULL;
 	int active = sub->result.active;
 	int inactive = sub->result.inactive;
-	if ( CN.context->expression.mode == ReadMode )
+	if ( currentContext()->expression.mode == ReadMode )
 	{
 		for ( listItem *i = results; i!=NULL; i=i->next )
 		{
@@ -427,20 +558,9 @@ invert_results( ExpressionSub *sub, int as_sub, listItem *results )
 	else
 	{
 		listItem *all = ( results == NULL ) ? CN.DB : results;
-		for ( listItem *i = all; i!=NULL; i=i->next )
-		{
-			Entity *e = (Entity *) i->ptr;
-
-			if ( !test_as_sub( e, as_sub ) )
-				continue;
-			if (( active && !cn_is_active(e) ) ||
-			    ( inactive && cn_is_active(e) ) )
-				continue;
-			if ( lookupItem( source, e ) == NULL )
-			{
-				addItem( &dest, e );
-			}
-		}
+		InvertVA va = { as_sub, active, inactive, source };
+		dest = exist ? scan_first( all, invert_test, &va ) :
+			scan( all, invert_test, &va, 0 );
 	}
 	freeListItem( &sub->result.list );
 	sub->result.list = dest;
@@ -449,8 +569,44 @@ invert_results( ExpressionSub *sub, int as_sub, listItem *results )
 /*---------------------------------------------------------------------------
 	take_all
 ---------------------------------------------------------------------------*/
+typedef struct {
+	int as_sub, count, check_instance;
+	int *active, *inactive;
+}
+TakeAllVA;
+
+static void *
+take_all_test( void *ptr, void *data )
+{
+	TakeAllVA *va = (TakeAllVA *) data;
+	int *active = va->active, *inactive = va->inactive;
+	int count = va->count;
+	Entity *e = (Entity *) ptr;
+
+	if ( !test_as_sub( e, va->as_sub ) )
+		return NULL;
+	if (( active[ 3 ] && !cn_is_active( e )) ||
+	    ( inactive[ 3 ] && cn_is_active( e )))
+		return NULL;
+	if (( count < 3 ) && ( e->sub[ count ] == NULL ))
+		return NULL;
+	if (  va->check_instance &&
+	    (( e->sub[ 1 ] == NULL ) ||
+	     ( active[ 0 ] && !cn_is_active( e->sub[ 0 ] )) ||
+	     ( active[ 1 ] && !cn_is_active( e->sub[ 1 ] )) ||
+	     ( active[ 2 ] && !cn_is_active( e->sub[ 2 ] )) ||
+	     ( inactive[ 0 ] && cn_is_active( e->sub[ 0 ] )) ||
+	     ( inactive[ 1 ] && cn_is_active( e->sub[ 1 ] )) ||
+	     ( inactive[ 2 ] && cn_is_active( e->sub[ 2 ] ))) )
+		return NULL;
+	return ( count == 3 ) ? e : e->sub[ count ];
+}
+
 listItem *
-take_all( Expression *expression, int as_sub, listItem *results )
+take_all( Expression *expression, int as_sub, listItem *results, int exist )
+/*
+	if exist is set, stops at the first result found
+*/
 {
 	listItem *dest = NULL;
 	int active[ 4 ];
@@ -476,7 +632,7 @@ take_all( Expression *expression, int as_sub, listItem *results )
 	fprintf( stderr, "debug> take_all: init done, as_sub=%d, count=%d, check_instance=%d\n", as_sub, count, check_instance );
 #endif
 
-	if ( CN.context->expression.mode == ReadMode )
+	if ( currentContext()->expression.mode == ReadMode )
 	{
 		for ( listItem *i = results; i!=NULL; i=i->next )
 		{
@@ -506,31 +662,9 @@ take_all( Expression *expression, int as_sub, listItem *results )
 	else
 	{
 		listItem *all = ( results == NULL ) ? CN.DB : results;
-		for ( listItem *i = all; i!=NULL; i=i->next )
-		{
-			Entity *e = (Entity *) i->ptr;
-			if ( !test_as_sub( e, as_sub ) )
-				continue;
-			if (( active[ 3 ] && !cn_is_active( e )) ||
-			    ( inactive[ 3 ] && cn_is_active( e )))
-				continue;
-			if (( count < 3 ) && ( e->sub[ count ] == NULL ))
-				continue;
-			if (  check_instance &&
-			    (( e->sub[ 1 ] == NULL ) ||
-			     ( active[ 0 ] && !cn_is_active( e->sub[ 0 ] )) ||
-			     ( active[ 1 ] && !cn_is_active( e->sub[ 1 ] )) ||
-			     ( active[ 2 ] && !cn_is_active( e->sub[ 2 ] )) ||
-			     ( inactive[ 0 ] && cn_is_active( e->sub[ 0 ] )) ||
-			     ( inactive[ 1 ] && cn_is_active( e->sub[ 1 ] )) ||
-			     ( inactive[ 2 ] && cn_is_active( e->sub[ 2 ] ))) )
-				continue;
-			if ( count == 3 ) {
-				addItem( &dest, e );
-			} else {
-				addIfNotThere( &dest, e->sub[ count ] );
-			}
-		}
+		TakeAllVA va = { as_sub, count, check_instance, active, inactive };
+		dest = exist ? scan_first( all, take_all_test, &va ) :
+			scan( all, take_all_test, &va, count < 3 );
 	}
 	return dest;
 }
@@ -545,7 +679,7 @@ take_sub_results( ExpressionSub *sub, int as_sub )
 	int active = sub->result.active;
 	int inactive = sub->result.inactive;
 	listItem **list = &sub->result.list;
-	if ( CN.context->expression.mode == ReadMode )
+	if ( currentContext()->expression.mode == ReadMode )
 	{
 		for ( listItem *i = *list; i!=NULL; i=next_i )
 		{
@@ -577,9 +711,28 @@ take_sub_results( ExpressionSub *sub, int as_sub )
 /*---------------------------------------------------------------------------
 	extract_sub_results
 ---------------------------------------------------------------------------*/
+typedef struct {
+	int as_sub, test_as_sub;
+	listItem *list0, *list3;
+}
+ExtractVA;
+
+static void *
+extract_test( void *ptr, void *data )
+{
+	ExtractVA *va = (ExtractVA *) data;
+	if ( va->test_as_sub && !test_as_sub( (Entity *) ptr, va->as_sub ) )
+		return NULL;
+	if (( lookupItem( va->list0, ptr ) != NULL ) ||
+	    ( lookupItem( va->list3, ptr ) != NULL ))
+		return NULL;
+	return ptr;
+}
+
 void
 extract_sub_results( ExpressionSub *sub0, ExpressionSub *sub3, int as_sub, listItem *results )
 {
+	_context *context = currentContext();
 	listItem **list = &sub0->result.list;
 	if (( sub0->result.active && sub3->result.inactive ) ||
 	    ( sub3->result.active && sub0->result.inactive ))
@@ -596,23 +749,11 @@ extract_sub_results( ExpressionSub *sub0, ExpressionSub *sub3, int as_sub, listI
 	listItem *last_i = NULL, *next_i;
 	if ( sub0->result.not && sub3->result.not )
 	{
-		listItem *all = ( CN.context->expression.mode == ReadMode ) ?
+		listItem *all = ( context->expression.mode == ReadMode ) ?
 			results : ( results == NULL ) ? CN.DB : results;
-		for ( listItem *i = all; i!=NULL; i=i->next )
-		{
-			if (( CN.context->expression.mode != ReadMode ) && !( as_sub & 8 ))
-			{
-				Entity *e = (Entity *) i->ptr;
-				if ( !test_as_sub( e, as_sub ) )
-					continue;
-			}
-
-			if (( lookupItem( *list, i->ptr ) == NULL ) &&
-			    ( lookupItem( sub3->result.list, i->ptr ) == NULL ) )
-			{
-				addItem( &last_i, i->ptr );
-			}
-		}
+		ExtractVA va = { as_sub, ( context->expression.mode != ReadMode ) && !( as_sub & 8 ),
+			*list, sub3->result.list };
+		last_i = scan( all, extract_test, &va, 0 );
 		freeListItem( list );
 		sub0->result.list = last_i;
 	}
@@ -625,7 +766,7 @@ extract_sub_results( ExpressionSub *sub0, ExpressionSub *sub3, int as_sub, listI
 		for ( listItem *i = *list; i!=NULL; i=next_i )
 		{
 			next_i = i->next;
-			if (( CN.context->expression.mode != ReadMode ) && !( as_sub & 8 ))
+			if (( context->expression.mode != ReadMode ) && !( as_sub & 8 ))
 			{
 				Entity *e = (Entity *) i->ptr;
 				if ( !test_as_sub( e, as_sub ) )
@@ -649,7 +790,7 @@ extract_sub_results( ExpressionSub *sub0, ExpressionSub *sub3, int as_sub, listI
 		for ( listItem *i = *list; i!=NULL; i=next_i )
 		{
 			next_i = i->next;
-			if (( CN.context->expression.mode != ReadMode ) && !( as_sub & 8 ))
+			if (( context->expression.mode != ReadMode ) && !( as_sub & 8 ))
 			{
 				Entity *e = (Entity *) i->ptr;
 				if ( !test_as_sub( e, as_sub ) )
@@ -7,8 +7,8 @@
 
 int	trace_mark( Expression *expression );
 int	mark_negated( Expression *expression, int negated );
-void	invert_results( ExpressionSub *sub, int as_sub, listItem *results );
-listItem *take_all( Expression *expression, int as_sub, listItem *results );
+void	invert_results( ExpressionSub *sub, int as_sub, listItem *results, int exist );
+listItem *take_all( Expression *expression, int as_sub, listItem *results, int exist );
 void	take_sub_results( ExpressionSub *sub, int as_sub );
 void	extract_sub_results( ExpressionSub *sub, ExpressionSub *sub3, int as_sub, listItem *results );
 int	test_as_sub( Entity *e, int as_sub );
@@ -4,19 +4,294 @@
 #include <stdarg.h>
 #include <string.h>
 #include <strings.h>
+#include <stdint.h>
+#include <time.h>
 
 #include "database.h"
 #include "registry.h"
 #include "kernel.h"
 
+#include "api.h"
 #include "input.h"
 #include "command.h"
 #include "expression.h"
 #include "narrative.h"
 #include "variables.h"
+#include "output.h"
+#include "frame.h"
+#include "trace.h"
+#include "memory.h"
+#include "parallel.h"
 
 // #define DEBUG
 
+/*---------------------------------------------------------------------------
+	frame logs
+---------------------------------------------------------------------------*/
+/*
+	The entity logs are kept as per-frame sets: each entity's logged field
+	tells which logs it is listed in, and which of these changes still
+	stand - opposing transitions cancelling each other out.
+	A listed entity which is released is not given back to the entity pool
+	before the logs are compacted - see freeEntity() - so that the logs
+	never point to freed or recycled memory, e.g. in batch mode, or after
+	:compact. Likewise a released standing query result is kept until the
+	queries let go of it, see update_queries().
+*/
+#define LISTED_INSTANTIATED	1
+#define LISTED_ACTIVATED	2
+#define LISTED_DEACTIVATED	4
+#define INSTANTIATED		8
+#define ACTIVATED		16
+#define DEACTIVATED		32
+#define LISTED			( LISTED_INSTANTIATED | LISTED_ACTIVATED | LISTED_DEACTIVATED )
+#define WATCHED			64	// standing query result - see update_queries()
+#define UNWATCHED		128	// released standing query result
+#define MATCHED			256	// transient - see diff_results()
+
+static void
+log_transition( listItem **log, Entity *e, int listed, int change, int opposite )
+{
+	if ( e->logged & opposite ) {
+		e->logged &= ~opposite;
+		return;
+	}
+	e->logged |= change;
+	if ( !( e->logged & listed )) {
+		e->logged |= listed;
+		addItem( log, e );
+	}
+}
+
+/*
+	Released entities are captured as flat literals, i.e. single blocks
+	holding their prefix encoding:
+		'n'		nil
+		's' name '\0'	named entity
+		'r' sub sub sub	relationship instance
+		'0'		none
+	which are expanded into entity-expressions - as cn_expression() would
+	build them - only when the released log is actually read.
+*/
+static int
+flat_size( Entity *e )
+{
+	if (( e == NULL ) || ( e == CN.nil ))
+		return 1;
+	char *name = cn_name( e );
+	if ( name != NULL )
+		return strlen( name ) + 2;
+	return 1 + flat_size( e->sub[ 0 ] ) + flat_size( e->sub[ 1 ] ) + flat_size( e->sub[ 2 ] );
+}
+
+static char *
+flatten( Entity *e, char *p )
+{
+	if ( e == NULL ) {
+		*p++ = '0';
+		return p;
+	}
+	if ( e == CN.nil ) {
+		*p++ = 'n';
+		return p;
+	}
+	char *name = cn_name( e );
+	if ( name != NULL ) {
+		*p++ = 's';
+		strcpy( p, name );
+		return p + strlen( name ) + 1;
+	}
+	*p++ = 'r';
+	for ( int i=0; i<3; i++ )
+		p = flatten( e->sub[ i ], p );
+	return p;
+}
+
+static Expression *
+expand( char **p )
+{
+	char tag = *(*p)++;
+	if ( tag == '0' )
+		return NULL;
+
+	Expression *expression = (Expression *) calloc( 1, sizeof(Expression) );
+	ExpressionSub *sub = expression->sub;
+	sub[ 3 ].result.any = 1;
+	sub[ 3 ].e = expression;
+
+	switch ( tag ) {
+	case 'n':
+		sub[ 0 ].result.identifier.type = NullIdentifier;
+		sub[ 1 ].result.none = 1;
+		sub[ 2 ].result.none = 1;
+		break;
+	case 's':
+		sub[ 0 ].result.identifier.type = DefaultIdentifier;
+		sub[ 0 ].result.identifier.value = strdup( *p );
+		*p += strlen( *p ) + 1;
+		sub[ 1 ].result.none = 1;
+		sub[ 2 ].result.none = 1;
+		break;
+	case 'r':
+		for ( int i=0; i<3; i++ ) {
+			if ( **p == 's' ) {
+				(*p)++;
+				sub[ i ].result.identifier.type = DefaultIdentifier;
+				sub[ i ].result.identifier.value = strdup( *p );
+				*p += strlen( *p ) + 1;
+			} else {
+				sub[ i ].e = expand( p );
+				sub[ i ].result.none = ( sub[ i ].e == NULL );
+			}
+		}
+		break;
+	}
+	return expression;
+}
+
+static listItem *
+released_literals( _context *context )
+/*
+	returns the entity-expressions of the entities released since the last
+	frame, in the order of the released log
+*/
+{
+	if (( context->frame.log.entities.literals == NULL ) &&
+	    ( context->frame.log.entities.released != NULL ))
+	{
+		listItem **literals = &context->frame.log.entities.literals;
+		for ( listItem *i = context->frame.log.entities.released; i!=NULL; i=i->next ) {
+			char *p = (char *) i->ptr;
+			Expression *expression = expand( &p );
+			addItem( literals, &expression->sub[ 3 ] );
+		}
+		reorderListItem( literals );
+	}
+	return context->frame.log.entities.literals;
+}
+
+static void
+free_released( listItem **released, listItem **literals )
+{
+	for ( listItem *i = *literals; i!=NULL; i=i->next ) {
+		ExpressionSub *s = (ExpressionSub *) i->ptr;
+		freeExpression( s->e );
+	}
+	freeListItem( literals );
+	for ( listItem *i = *released; i!=NULL; i=i->next )
+		free( i->ptr );
+	freeListItem( released );
+}
+
+static int
+release_listened( _context *context )
+/*
+	returns true if either an active narrative, a subscriber or a standing
+	query may read release events. The answer is cached until either of
+	these come or go - see listenersChanged()
+*/
+{
+	if ( context->frame.listened.known )
+		return context->frame.listened.value;
+
+	int listened = ( context->frame.queries != NULL );
+	for ( listItem *i = context->frame.subscribers; i!=NULL && !listened; i=i->next )
+		if ( ((Subscription *) i->ptr )->type == ReleaseEvent )
+			listened = 1;
+	for ( listItem *i = context->narrative.registered; i!=NULL && !listened; i=i->next ) {
+		Narrative *narrative = (Narrative *) i->ptr;
+		if ( narrative->release && ( narrative->instances != NULL ))
+			listened = 1;
+	}
+	context->frame.listened.known = 1;
+	context->frame.listened.value = listened;
+	return listened;
+}
+
+void
+listenersChanged( _context *context )
+/*
+	to be invoked whenever a narrative instance, a subscriber or a standing
+	query comes or goes
+*/
+{
+	context->frame.listened.known = 0;
+}
+
+void
+logEntity( EventType type, Entity *e, _context *context )
+/*
+	logs e's change for the next frame. An entity is listed only once per
+	log, and an entity released in the same frame as it was instantiated
+	is not logged at all. The literals of released entities are captured
+	in flat form, and only if anyone listens to release events.
+*/
+{
+	switch ( type ) {
+	case InstantiateEvent:
+		log_transition( &context->frame.log.entities.instantiated, e,
+			LISTED_INSTANTIATED, INSTANTIATED, 0 );
+		break;
+	case ReleaseEvent:
+		if ( e->logged & WATCHED ) {
+			e->logged = ( e->logged & ~WATCHED ) | UNWATCHED;
+			addItem( &context->frame.log.entities.unwatched, e );
+		}
+		if ( e->logged & INSTANTIATED ) {
+			e->logged &= ~INSTANTIATED;
+			break;
+		}
+		context->frame.log.entities.releases++;
+		if ( release_listened( context ) ) {
+			char *literal = (char *) malloc( flat_size( e ) );
+			flatten( e, literal );
+			addItem( &context->frame.log.entities.released, literal );
+		}
+		break;
+	case ActivateEvent:
+		log_transition( &context->frame.log.entities.activated, e,
+			LISTED_ACTIVATED, ACTIVATED, DEACTIVATED );
+		break;
+	case DeactivateEvent:
+		log_transition( &context->frame.log.entities.deactivated, e,
+			LISTED_DEACTIVATED, DEACTIVATED, ACTIVATED );
+		break;
+	}
+}
+
+static void
+compact_log( listItem **log, int listed, int change )
+/*
+	removes from log the changes which were cancelled - or whose entity
+	was released since - and resets the listed entities' membership. The
+	released entities are reclaimed once no log lists them anymore.
+*/
+{
+	listItem *last_i = NULL, *next_i;
+	for ( listItem *i = *log; i!=NULL; i=next_i )
+	{
+		next_i = i->next;
+		Entity *e = (Entity *) i->ptr;
+		int keep = ( e->state != -1 ) && ( e->logged & change );
+		e->logged &= ~( listed | change );
+		if (( e->state == -1 ) && !( e->logged & ( LISTED | UNWATCHED )))
+			reclaimEntity( e );
+		if ( keep ) {
+			last_i = i;
+			continue;
+		}
+		clipListItem( log, i, last_i, next_i );
+	}
+}
+
+static void
+compact_logs( _context *context )
+{
+	compact_log( &context->frame.log.entities.instantiated, LISTED_INSTANTIATED, INSTANTIATED );
+	compact_log( &context->frame.log.entities.activated, LISTED_ACTIVATED, ACTIVATED );
+	compact_log( &context->frame.log.entities.deactivated, LISTED_DEACTIVATED, DEACTIVATED );
+}
+
 /*---------------------------------------------------------------------------
 	search_and_register_events	- recursive
 ---------------------------------------------------------------------------*/
@@ -27,6 +302,7 @@ test_and_register_event( Narrative *instance, listItem *log, Occurrence *occurre
 		return;	// either registered already or no such events logged in this frame
 
 	context->expression.mode = ( occurrence->va.event.type.release ? ReadMode : EvaluateMode );
+	context->expression.exist = ( occurrence->va.event.identifier.name == NULL );
 	context->expression.filter = log;
 	int success = expression_solve( occurrence->va.event.expression, 3, context );
 	context->expression.filter = NULL;
@@ -68,6 +344,7 @@ search_and_register_events( Narrative *instance, Occurrence *thread, _context *c
 				break;	// condition following event
 			}
 			context->expression.mode = EvaluateMode;
+			context->expression.exist = 1;
 			expression_solve( occurrence->va.condition.expression, 3, context );
 			if ( context->expression.results != NULL ) {
 				search_and_register_events( instance, occurrence, context );
@@ -89,7 +366,7 @@ search_and_register_events( Narrative *instance, Occurrence *thread, _context *c
 			else if ( occurrence->va.event.type.deactivate )
 				log = context->frame.log.entities.deactivated;
 			else if ( occurrence->va.event.type.release )
-				log = context->frame.log.entities.released;
+				log = released_literals( context );
 			test_and_register_event( instance, log, occurrence, context );
 
 			if ( occurrence->registered ) {
@@ -122,6 +399,7 @@ search_and_register_init( Narrative *narrative, Occurrence *thread, _context *co
 				break;	// condition following event
 			}
 			context->expression.mode = EvaluateMode;
+			context->expression.exist = 1;
 			expression_solve( occurrence->va.condition.expression, 3, context );
 			if ( context->expression.results != NULL ) {
 				search_and_register_init( narrative, occurrence, context );
@@ -200,6 +478,7 @@ search_and_register_actions( Narrative *narrative, Occurrence *thread, _context
 		switch ( occurrence->type ) {
 		case ConditionOccurrence:
 			context->expression.mode = EvaluateMode;
+			context->expression.exist = 1;
 			expression_solve( occurrence->va.condition.expression, 3, context );
 			if ( context->expression.results != NULL ) {
 				search_and_register_actions( narrative, occurrence, context );
@@ -223,8 +502,12 @@ search_and_register_actions( Narrative *narrative, Occurrence *thread, _context
 /*---------------------------------------------------------------------------
 	execute_narrative_actions
 ---------------------------------------------------------------------------*/
-static int
-execute_narrative_actions( Narrative *instance, _context *context )
+static void
+perform_actions( Narrative *instance, _context *context )
+/*
+	performs instance's actions, which must be in FIFO order - see
+	execute_narrative_actions() - leaving them registered
+*/
 {
         push( base, 0, NULL, context );
 	StackVA *stack = (StackVA *) context->control.stack->ptr;
@@ -232,10 +515,6 @@ execute_narrative_actions( Narrative *instance, _context *context )
 	context->narrative.current = instance;
 	context->narrative.level = context->control.level + 1;
 
-	// frame.occurrences, frame.events and frame.actions are all LIFO
-	// we must reorder the actions to execute them in FIFO order
-	reorderListItem( &instance->frame.actions );
-
 	for ( listItem *i = instance->frame.actions; i!=NULL; i=i->next )
 	{
 		Occurrence *occurrence = (Occurrence *) i->ptr;
@@ -270,7 +549,7 @@ execute_narrative_actions( Narrative *instance, _context *context )
 			context->narrative.mode.action.block = 0;
 		}
 
-		if ( instance->deactivate )
+		if ( instance->deactivate || context->frame.writes.serial )
 			break;
 
 		for ( listItem *j = occurrence->thread->sub.n; j!=NULL; j=j->next )
@@ -283,23 +562,970 @@ execute_narrative_actions( Narrative *instance, _context *context )
 		}
 	}
 
-	freeListItem( &instance->frame.actions );
 	context->narrative.level = 0;
 	context->narrative.current = NULL;
 	stack->variables = NULL;
         pop( base, 0, NULL, context );
+}
+
+static int
+execute_narrative_actions( Narrative *instance, _context *context )
+{
+	// frame.occurrences, frame.events and frame.actions are all LIFO
+	// we must reorder the actions to execute them in FIFO order
+	reorderListItem( &instance->frame.actions );
+	perform_actions( instance, context );
+	freeListItem( &instance->frame.actions );
 	return 0;
 }
 
+/*---------------------------------------------------------------------------
+	deferred writes
+---------------------------------------------------------------------------*/
+int
+setWritePolicy( char *policy, _context *context )
+/*
+	immediate: actions write to the database at once - the default
+	last, first, strict: the action phase's writes are deferred and merged
+	once all narrative instances have run, conflicting writes - e.g. an
+	entity activated by one instance and released by another - being
+	resolved respectively in favor of the last writer, of the first
+	writer, or dropped altogether. The instances then run their actions
+	in parallel - see parallel_actions() - but for those which do what
+	only the main thread may, e.g. instantiate, which run there after the
+	others did, though still in instance order.
+	Returns -1 if policy is not one of these.
+*/
+{
+	WritePolicy value =
+		!strcmp( policy, "immediate" ) ? ImmediateWrites :
+		!strcmp( policy, "last" ) ? LastWriterWins :
+		!strcmp( policy, "first" ) ? FirstWriterWins :
+		!strcmp( policy, "strict" ) ? DropConflicts : -1;
+	if ( value == -1 )
+		return -1;
+	context->frame.writes.policy = value;
+	return 0;
+}
+
+int
+deferChanges( ExpressionMode mode, listItem *entities, _context *context )
+/*
+	logs the changes made by the narrative instance currently executing
+	its actions, if writes are being deferred. Instantiations are logged
+	for conflict detection only, as they took place already - and could
+	not affect any other instance's snapshot but by adding to it.
+	Returns 1 if the changes are deferred, 0 otherwise.
+*/
+{
+	if ( !context->frame.writes.writer )
+		return 0;
+
+	EventType type =
+		( mode == InstantiateMode ) ? InstantiateEvent :
+		( mode == ReleaseMode ) ? ReleaseEvent :
+		( mode == ActivateMode ) ? ActivateEvent :
+		( mode == DeactivateMode ) ? DeactivateEvent : 0;
+	if ( type == 0 )
+		return 0;
+
+	for ( listItem *i = entities; i!=NULL; i=i->next ) {
+		Change *change = (Change *) malloc( sizeof(Change) );
+		change->type = type;
+		change->entity = (Entity *) i->ptr;
+		change->writer = context->frame.writes.writer;
+		addItem( &context->frame.writes.log, change );
+	}
+	return 1;
+}
+
+int
+serialOnly( _context *context )
+/*
+	tells whether the narrative instance whose actions are running in
+	parallel - see parallel_actions() - is about to do what only the main
+	thread may, in which case its current command must be refused, and
+	the instance run again, serially.
+*/
+{
+	if ( !context->frame.writes.parallel )
+		return 0;
+	context->frame.writes.serial = 1;
+	return 1;
+}
+
+static void
+merge_changes( _context *context )
+/*
+	applies the deferred writes, in the order in which they were made.
+	Each entity gets one winning change: an instance's own changes
+	overwrite each other, as in immediate mode, whereas different changes
+	from different instances conflict, and are resolved according to the
+	write policy. Releases are applied last, as they may cascade.
+*/
+{
+	listItem *log = context->frame.writes.log;
+	context->frame.writes.log = NULL;
+	if ( log == NULL )
+		return;
+
+	reorderListItem( &log );
+	Registry winners = NULL;	// { ( entity, change ) }
+	for ( listItem *i = log; i!=NULL; i=i->next )
+	{
+		Change *change = (Change *) i->ptr;
+		registryEntry *entry = lookupByAddress( winners, change->entity );
+		if ( entry == NULL ) {
+			registerByAddress( &winners, change->entity, change );
+			continue;
+		}
+		Change *winner = (Change *) entry->value;
+		if ( winner == NULL )
+			continue;	// dropped
+		if (( winner->writer == change->writer ) || ( winner->type == change->type )) {
+			entry->value = change;
+			continue;
+		}
+		switch ( context->frame.writes.policy ) {
+		case LastWriterWins:
+			entry->value = change;
+			break;
+		case FirstWriterWins:
+			break;
+		default:
+			; FILE *restore = setOutputStream( stderr );
+			fprintf( stderr, "consensus> Warning: conflicting changes on '" );
+			output_name( change->entity, NULL, 0 );
+			fprintf( stderr, "' - dropped\n" );
+			setOutputStream( restore );
+			entry->value = NULL;
+			break;
+		}
+	}
+#ifdef DEBUG
+	fprintf( stderr, "debug> merge_changes: applying...\n" );
+#endif
+	listItem *released = NULL;
+	for ( int pass=0; pass<2; pass++ )
+	for ( listItem *i = log; i!=NULL; i=i->next )
+	{
+		Change *change = (Change *) i->ptr;
+		Entity *e = change->entity;
+		if (( e->state == -1 ) || ( lookupByAddress( winners, e )->value != change ))
+			continue;
+		switch ( change->type ) {
+		case ReleaseEvent:
+			if ( pass ) addItem( &released, e );
+			break;
+		case ActivateEvent:
+			if ( !pass ) cn_activate( e );
+			break;
+		case DeactivateEvent:
+			if ( !pass ) cn_deactivate( e );
+			break;
+		default:
+			break;
+		}
+	}
+	reorderListItem( &released );
+	cn_release_entities( released );
+	freeListItem( &released );
+	freeRegistry( &winners );
+	for ( listItem *i = log; i!=NULL; i=i->next )
+		free( i->ptr );
+	freeListItem( &log );
+}
+
+/*---------------------------------------------------------------------------
+	standing queries
+---------------------------------------------------------------------------*/
+static int
+query_terms( Expression *expression, StandingQuery *query )
+/*
+	collects expression's identifiers into query->terms.names, and tells
+	whether its results may depend on states. Returns 0 if the identifiers
+	do not bound the changes which may affect the results, i.e. if the
+	expression involves negations, variables, lists or as-sub conditions.
+*/
+{
+	ExpressionSub *sub = expression->sub;
+	for ( int i=0; i<4; i++ ) {
+		if ( sub[ i ].result.active || sub[ i ].result.inactive )
+			query->terms.states = 1;
+		if ( sub[ i ].result.not || sub[ i ].result.lookup ||
+		     sub[ i ].result.resolve || ( sub[ i ].result.list != NULL ))
+			return 0;
+	}
+	if (( sub[ 3 ].e != NULL ) && ( sub[ 3 ].e != expression ))
+		return 0;
+	for ( int i=0; i<3; i++ ) {
+		if ( sub[ i ].e != NULL ) {
+			if ( !query_terms( sub[ i ].e, query ) )
+				return 0;
+			continue;
+		}
+		if ( sub[ i ].result.any || sub[ i ].result.none )
+			continue;
+		switch ( sub[ i ].result.identifier.type ) {
+		case DefaultIdentifier:
+			addItem( &query->terms.names, sub[ i ].result.identifier.value );
+			break;
+		case NullIdentifier:
+			break;
+		default:
+			return 0;
+		}
+	}
+	return 1;
+}
+
+static int
+entity_involves( Entity *e, listItem *entities )
+/*
+	returns true if e is or has - at any depth - one of entities as sub
+*/
+{
+	if ( e == NULL )
+		return 0;
+	if ( lookupItem( entities, e ) != NULL )
+		return 1;
+	for ( int i=0; i<3; i++ )
+		if ( entity_involves( e->sub[ i ], entities ) )
+			return 1;
+	return 0;
+}
+
+static int
+literal_involves( char **p, listItem *names )
+/*
+	same as entity_involves(), for a flat literal - see flatten()
+*/
+{
+	switch ( *(*p)++ ) {
+	case 's':
+		for ( listItem *i = names; i!=NULL; i=i->next )
+			if ( !strcmp( *p, i->ptr ) ) return 1;
+		*p += strlen( *p ) + 1;
+		return 0;
+	case 'r':
+		for ( int i=0; i<3; i++ )
+			if ( literal_involves( p, names ) ) return 1;
+		return 0;
+	default:
+		return 0;
+	}
+}
+
+static void
+touch_queries( listItem **log, listItem *released, _context *context )
+/*
+	tells which standing queries this frame's changes may have affected.
+	A change which affects the results of an expression without negation
+	nor variable - the only ones which query_terms() bounds - instantiates
+	or releases an entity matching the whole expression, and therefore
+	involves all of its identifiers, if not - as a state change - the
+	entity of any of its terms. Called before any callback, while all the
+	logged entities still exist.
+*/
+{
+	if (( log[ 0 ] == NULL ) && ( log[ 2 ] == NULL ) && ( log[ 3 ] == NULL ) && ( released == NULL ))
+		return;
+	for ( listItem *i = context->frame.queries; i!=NULL; i=i->next )
+	{
+		StandingQuery *query = (StandingQuery *) i->ptr;
+		query->touched = query->terms.any ||
+			( query->terms.states && (( log[ 2 ] != NULL ) || ( log[ 3 ] != NULL )));
+		if ( query->touched )
+			continue;
+
+		listItem *entities = NULL;
+		if ( log[ 0 ] != NULL )
+			for ( listItem *j = query->terms.names; j!=NULL; j=j->next ) {
+				registryEntry *entry = lookupByName( CN.registry, j->ptr );
+				if ( entry != NULL ) addItem( &entities, entry->value );
+			}
+		for ( listItem *j = log[ 0 ]; ( entities != NULL ) && ( j != NULL ); j=j->next )
+			if ( entity_involves( (Entity *) j->ptr, entities ) ) {
+				query->touched = 1;
+				break;
+			}
+		freeListItem( &entities );
+
+		for ( listItem *j = released; !query->touched && ( j != NULL ); j=j->next ) {
+			char *p = (char *) j->ptr;
+			query->touched = literal_involves( &p, query->terms.names );
+		}
+	}
+}
+
+static int
+by_address( const void *a, const void *b )
+{
+	uintptr_t x = (uintptr_t) *(Entity **) a, y = (uintptr_t) *(Entity **) b;
+	return ( x > y ) - ( x < y );
+}
+
+static void
+register_results( StandingQuery *query, listItem *entities )
+/*
+	registers entities - none of which is registered already - each with
+	its entity-expression, in a single pass through query->results
+*/
+{
+	int count = 0;
+	for ( listItem *i = entities; i!=NULL; i=i->next ) count++;
+	if ( count == 0 )
+		return;
+	Entity **sorted = (Entity **) malloc( count * sizeof(Entity *) );
+	count = 0;
+	for ( listItem *i = entities; i!=NULL; i=i->next )
+		sorted[ count++ ] = (Entity *) i->ptr;
+	qsort( sorted, count, sizeof(Entity *), by_address );
+
+	registryEntry **r = &query->results;
+	for ( int k=0; k<count; k++ ) {
+		Entity *e = sorted[ k ];
+		while (( *r != NULL ) && ( (uintptr_t) (*r)->identifier < (uintptr_t) e ))
+			r = &(*r)->next;
+		registryEntry *entry = newRegistryItem( e, cn_expression( e ) );
+		entry->next = *r;
+		*r = entry;
+		r = &entry->next;
+		e->logged |= WATCHED;
+	}
+	free( sorted );
+}
+
+static void
+diff_results( StandingQuery *query, listItem **added, listItem **removed, _context *context )
+/*
+	solves query in full, and compares its results with the previous ones
+*/
+{
+	context->expression.mode = EvaluateMode;
+	int success = expression_solve( query->expression, 3, context );
+	listItem *results = context->expression.results;
+	context->expression.results = NULL;
+	if ( success <= 0 )
+		freeListItem( &results );
+
+	for ( listItem *i = results; i!=NULL; i=i->next )
+		((Entity *) i->ptr )->logged |= MATCHED;
+
+	// previous results no longer matching are removed, the others unmarked
+	registryEntry *last_r = NULL, *next_r;
+	for ( registryEntry *r = query->results; r!=NULL; r=next_r ) {
+		next_r = r->next;
+		Entity *e = (Entity *) r->identifier;
+		if ( e->logged & MATCHED ) {
+			e->logged &= ~MATCHED;
+			last_r = r;
+			continue;
+		}
+		addItem( removed, &((Expression *) r->value )->sub[ 3 ] );
+		if ( last_r == NULL ) query->results = next_r;
+		else last_r->next = next_r;
+		freeRegistryItem( r );
+	}
+	// results still marked are new
+	for ( listItem *i = results; i!=NULL; i=i->next ) {
+		Entity *e = (Entity *) i->ptr;
+		if ( e->logged & MATCHED ) {
+			e->logged &= ~MATCHED;
+			addItem( added, e );
+		}
+	}
+	freeListItem( &results );
+	register_results( query, *added );
+}
+
+static void
+take_released( StandingQuery *query, listItem **removed )
+/*
+	removes from query->results the entities released since the last frame
+*/
+{
+	registryEntry *last_r = NULL, *next_r;
+	for ( registryEntry *r = query->results; r!=NULL; r=next_r ) {
+		next_r = r->next;
+		if ( !( ((Entity *) r->identifier )->logged & UNWATCHED )) {
+			last_r = r;
+			continue;
+		}
+		addItem( removed, &((Expression *) r->value )->sub[ 3 ] );
+		if ( last_r == NULL ) query->results = next_r;
+		else last_r->next = next_r;
+		freeRegistryItem( r );
+	}
+}
+
+static void
+update_queries( _context *context )
+/*
+	the standing queries which this frame's changes may have affected - see
+	touch_queries() - are solved again in full, and their new results
+	compared with the previous ones, which each query keeps in its own
+	registry. Released results are known from their release, which keeps
+	them until now - see logEntity() - so that no freed or recycled entity
+	is ever looked up.
+*/
+{
+	listItem *unwatched = context->frame.log.entities.unwatched;
+	context->frame.log.entities.unwatched = NULL;
+
+	listItem *next_i;
+	for ( listItem *i = context->frame.queries; i!=NULL; i=next_i )
+	{
+		StandingQuery *query = (StandingQuery *) i->ptr;
+		next_i = i->next;	// callback may unwatch
+		listItem *added = NULL, *removed = NULL;
+
+		if ( unwatched != NULL )
+			take_released( query, &removed );
+		if ( query->touched || ( removed != NULL ))
+			diff_results( query, &added, &removed, context );
+		query->touched = 0;
+
+		if (( added != NULL ) || ( removed != NULL )) {
+			reorderListItem( &added );
+			reorderListItem( &removed );
+			query->callback( added, removed, query->user_data );
+		}
+		freeListItem( &added );
+		for ( listItem *j = removed; j!=NULL; j=j->next ) {
+			ExpressionSub *s = (ExpressionSub *) j->ptr;
+			freeExpression( s->e );
+		}
+		freeListItem( &removed );
+	}
+
+	for ( listItem *i = unwatched; i!=NULL; i=i->next ) {
+		Entity *e = (Entity *) i->ptr;
+		e->logged &= ~UNWATCHED;
+		if ( !( e->logged & LISTED ))
+			reclaimEntity( e );
+	}
+	freeListItem( &unwatched );
+}
+
+void
+watchQuery( StandingQuery *query, _context *context )
+/*
+	registers query, invoking its callback at once with its current results
+*/
+{
+	query->terms.any = !query_terms( query->expression, query ) ||
+		( query->terms.names == NULL );
+
+	listItem *added = NULL, *removed = NULL;
+	diff_results( query, &added, &removed, context );
+	if ( added != NULL ) {
+		reorderListItem( &added );
+		query->callback( added, NULL, query->user_data );
+		freeListItem( &added );
+	}
+	addItem( &context->frame.queries, query );
+	listenersChanged( context );
+}
+
+/*---------------------------------------------------------------------------
+	notify_subscribers
+---------------------------------------------------------------------------*/
+static void
+sweep_subscribers( _context *context )
+/*
+	frees the subscriptions cancelled during notification - see
+	cn_unsubscribe()
+*/
+{
+	listItem *last_i = NULL, *next_i;
+	for ( listItem *i = context->frame.subscribers; i!=NULL; i=next_i )
+	{
+		Subscription *subscription = (Subscription *) i->ptr;
+		next_i = i->next;
+		if ( !subscription->cancelled ) {
+			last_i = i;
+			continue;
+		}
+		clipListItem( &context->frame.subscribers, i, last_i, next_i );
+		free( subscription );
+		listenersChanged( context );
+	}
+}
+
+static void
+notify_subscribers( _context *context )
+{
+	// detach this frame's logs first, so that the changes made by the
+	// callbacks themselves are logged for the next frame
+	listItem *log[ 4 ];
+	log[ 0 ] = context->frame.log.entities.instantiated;
+	log[ 1 ] = NULL;
+	log[ 2 ] = context->frame.log.entities.activated;
+	log[ 3 ] = context->frame.log.entities.deactivated;
+	context->frame.log.entities.instantiated = NULL;
+	context->frame.log.entities.activated = NULL;
+	context->frame.log.entities.deactivated = NULL;
+
+	// released literals are only expanded for release subscribers
+	listItem *released = context->frame.log.entities.released;
+	listItem *literals = context->frame.log.entities.literals;
+	for ( listItem *i = context->frame.subscribers; i!=NULL; i=i->next )
+		if ( ((Subscription *) i->ptr )->type == ReleaseEvent ) {
+			log[ 1 ] = literals = released_literals( context );
+			break;
+		}
+	context->frame.log.entities.released = NULL;
+	context->frame.log.entities.literals = NULL;
+	context->frame.log.entities.releases = 0;
+	touch_queries( log, released, context );
+
+	// callbacks may unsubscribe, themselves or others - such subscriptions
+	// are only marked cancelled meanwhile, and swept afterwards
+	context->frame.notifying++;
+	for ( listItem *i = context->frame.subscribers; i!=NULL; i=i->next )
+	{
+		Subscription *subscription = (Subscription *) i->ptr;
+		if ( subscription->cancelled )
+			continue;
+		EventType type = subscription->type;
+		listItem *changes = log[ type - InstantiateEvent ];
+		if ( changes == NULL )
+			continue;
+		if ( subscription->filter == NULL ) {
+			subscription->callback( type, changes, subscription->user_data );
+			continue;
+		}
+		context->expression.mode = ( type == ReleaseEvent ) ? ReadMode : EvaluateMode;
+		context->expression.filter = changes;
+		int success = expression_solve( subscription->filter, 3, context );
+		context->expression.filter = NULL;
+		if ( success <= 0 ) continue;
+
+		changes = context->expression.results;
+		context->expression.results = NULL;
+		subscription->callback( type, changes, subscription->user_data );
+		if ( type == ReleaseEvent ) {
+			// filtered literals are standalone copies
+			for ( listItem *j = changes; j!=NULL; j=j->next ) {
+				ExpressionSub *s = (ExpressionSub *) j->ptr;
+				freeExpression( s->e );
+			}
+		}
+		freeListItem( &changes );
+	}
+	if ( --context->frame.notifying == 0 )
+		sweep_subscribers( context );
+
+	update_queries( context );
+
+	for ( int i=0; i<4; i++ )
+		if ( i != 1 ) freeListItem( &log[ i ] );
+
+	free_released( &released, &literals );
+}
+
+/*---------------------------------------------------------------------------
+	settled_frame, idle_frame
+---------------------------------------------------------------------------*/
+static int
+settled_frame( _context *context )
+/*
+	returns true if no change was logged and no narrative event is pending,
+	in which case a frame may only execute the actions registered from the
+	narratives' conditions - which it would register again, unless these
+	actions change something.
+*/
+{
+	return	( context->frame.log.entities.instantiated == NULL ) &&
+		!context->frame.log.entities.releases &&
+		( context->frame.log.entities.activated == NULL ) &&
+		( context->frame.log.entities.deactivated == NULL ) &&
+		( context->frame.log.narratives.activate == NULL ) &&
+		( context->frame.log.narratives.deactivate == NULL ) &&
+		!context->frame.pending.events;
+}
+
+static int
+idle_frame( _context *context )
+/*
+	returns true if a frame would have nothing to do at all
+*/
+{
+	return settled_frame( context ) && !context->frame.pending.actions;
+}
+
+/*---------------------------------------------------------------------------
+	frame statistics
+---------------------------------------------------------------------------*/
+/*
+	Frame timings are recorded into log-linear histograms - in the manner
+	of HDR histograms: values below SUB_BUCKETS are counted exactly, and
+	each power of two above is split into SUB_BUCKETS linear buckets, so
+	that percentiles are reported within 1/SUB_BUCKETS of their value.
+	Times are in ns.
+*/
+#define SUB_BUCKETS	16
+#define MAGNITUDES	40	// values up to 2^43, i.e. some 2 hours in ns
+#define BUCKETS		( SUB_BUCKETS * ( MAGNITUDES + 1 ))
+
+typedef struct {
+	unsigned long count[ BUCKETS ];
+	unsigned long total;
+	long min, max;
+	double sum;
+}
+Histogram;
+
+typedef enum {
+	DeactivatePhase,
+	ActionsPhase,
+	TranslatePhase,
+	RegisterPhase,
+	ActivatePhase,
+	FrameTotal,
+	Phases
+}
+FramePhase;
+
+static char *phase_name[ Phases ] = {
+	"deactivate", "actions", "translate", "register", "activate", "frame"
+};
+
+static struct {
+	Histogram phase[ Phases ];
+	Histogram log;		// log entries processed per frame
+	Registry narratives;	// { ( name, Histogram ) } action time per instance
+	unsigned long frames;	// run since start - not reset
+} FrameStats;
+
+static int
+bucket_index( long value )
+{
+	if ( value < SUB_BUCKETS )
+		return ( value < 0 ) ? 0 : value;
+	int magnitude = 63 - __builtin_clzl( value ) - 3;	// >= 1
+	if ( magnitude > MAGNITUDES )
+		return BUCKETS - 1;
+	return magnitude * SUB_BUCKETS + (( value >> ( magnitude - 1 )) & ( SUB_BUCKETS - 1 ));
+}
+
+static long
+bucket_value( int index )
+/*
+	returns the highest value counted in bucket index
+*/
+{
+	if ( index < SUB_BUCKETS )
+		return index;
+	int magnitude = index / SUB_BUCKETS;
+	long sub = SUB_BUCKETS + index % SUB_BUCKETS;
+	return (( sub + 1 ) << ( magnitude - 1 )) - 1;
+}
+
+static void
+record( Histogram *histogram, long value )
+{
+	if (( histogram->total == 0 ) || ( value < histogram->min ))
+		histogram->min = value;
+	if ( value > histogram->max )
+		histogram->max = value;
+	histogram->count[ bucket_index( value ) ]++;
+	histogram->total++;
+	histogram->sum += value;
+}
+
+static long
+percentile( Histogram *histogram, double p )
+{
+	unsigned long rank = (unsigned long) ( p / 100 * histogram->total + 0.5 );
+	if ( rank < 1 ) rank = 1;
+	unsigned long count = 0;
+	for ( int i=0; i<BUCKETS; i++ ) {
+		count += histogram->count[ i ];
+		if ( count >= rank ) {
+			long value = bucket_value( i );
+			return ( value > histogram->max ) ? histogram->max : value;
+		}
+	}
+	return histogram->max;
+}
+
+static long
+now( void )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+static void
+record_phase( FramePhase phase, long *start )
+{
+	long t = now();
+	record( &FrameStats.phase[ phase ], t - *start );
+	traceSpan( "frame", phase_name[ phase ], *start, NULL );
+	*start = t;
+}
+
+static void
+record_narrative( Narrative *narrative, long time )
+{
+	registryEntry *entry = lookupByName( FrameStats.narratives, narrative->name );
+	if ( entry == NULL )
+		entry = registerByName( &FrameStats.narratives, strdup( narrative->name ),
+			calloc( 1, sizeof(Histogram) ));
+	record( (Histogram *) entry->value, time );
+}
+
+static int
+log_size( _context *context )
+{
+	int count = context->frame.log.entities.releases;
+	listItem *log[ 3 ] = {
+		context->frame.log.entities.instantiated,
+		context->frame.log.entities.activated,
+		context->frame.log.entities.deactivated
+	};
+	for ( int n=0; n<3; n++ )
+		for ( listItem *i = log[ n ]; i!=NULL; i=i->next ) count++;
+	return count;
+}
+
+static void
+output_histogram( FILE *stream, char *name, Histogram *histogram, double unit )
+{
+	if ( histogram->total == 0 ) {
+		fprintf( stream, "%-16s %10d\n", name, 0 );
+		return;
+	}
+	fprintf( stream, "%-16s %10lu %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+		name, histogram->total, histogram->sum / histogram->total / unit,
+		percentile( histogram, 50 ) / unit, percentile( histogram, 90 ) / unit,
+		percentile( histogram, 99 ) / unit, percentile( histogram, 99.9 ) / unit,
+		histogram->max / unit );
+}
+
+static void
+output_buckets( FILE *stream, char *name, Histogram *histogram )
+{
+	for ( int i=0; i<BUCKETS; i++ )
+		if ( histogram->count[ i ] )
+			fprintf( stream, "%s\t%ld\t%lu\n", name, bucket_value( i ), histogram->count[ i ] );
+}
+
+void
+outputFrameStats( FILE *stream, int buckets )
+/*
+	outputs the frame statistics gathered so far - times in ms - and, if
+	buckets is set, the histograms' non-empty buckets, tab-separated:
+		name	highest-value-in-bucket	count
+*/
+{
+	char *header = "%-16s %10s %10s %10s %10s %10s %10s %10s\n";
+	fprintf( stream, header, "phase (ms)", "count", "mean", "p50", "p90", "p99", "p99.9", "max" );
+	for ( int i=0; i<Phases; i++ )
+		output_histogram( stream, phase_name[ i ], &FrameStats.phase[ i ], 1e6 );
+	fprintf( stream, header, "log entries", "frames", "mean", "p50", "p90", "p99", "p99.9", "max" );
+	output_histogram( stream, "per frame", &FrameStats.log, 1 );
+	if ( FrameStats.narratives != NULL )
+		fprintf( stream, header, "narrative (ms)", "actions", "mean", "p50", "p90", "p99", "p99.9", "max" );
+	for ( registryEntry *r = FrameStats.narratives; r!=NULL; r=r->next )
+		output_histogram( stream, r->identifier, r->value, 1e6 );
+
+	if ( !buckets )
+		return;
+	for ( int i=0; i<Phases; i++ )
+		output_buckets( stream, phase_name[ i ], &FrameStats.phase[ i ] );
+	output_buckets( stream, "log", &FrameStats.log );
+	for ( registryEntry *r = FrameStats.narratives; r!=NULL; r=r->next )
+		output_buckets( stream, r->identifier, r->value );
+}
+
+void
+resetFrameStats( void )
+{
+	memset( FrameStats.phase, 0, sizeof(FrameStats.phase) );
+	memset( &FrameStats.log, 0, sizeof(FrameStats.log) );
+	for ( registryEntry *r = FrameStats.narratives; r!=NULL; r=r->next ) {
+		free( r->identifier );
+		free( r->value );
+	}
+	freeRegistry( &FrameStats.narratives );
+}
+
+/*---------------------------------------------------------------------------
+	parallel_actions
+---------------------------------------------------------------------------*/
+typedef struct {
+	Entity *entity;
+	Narrative *narrative, *instance;
+	int writer;
+	listItem *changes;	// { change } LIFO
+	char *output;
+	size_t size;
+	long time;
+	int serial;
+}
+ActionTask;
+
+typedef struct {
+	_context *context;
+	ActionTask *tasks;
+}
+ActionsVA;
+
+static __thread _context *Worker = NULL;
+
+static _context *
+worker_context( _context *context )
+/*
+	returns the calling thread's context for running narrative actions,
+	which is created upon first call, the way cn_init() creates CN.context
+*/
+{
+	if ( Worker == NULL ) {
+		Worker = (_context *) calloc( 1, sizeof(_context) );
+		StackVA *stack = (StackVA *) calloc( 1, sizeof(StackVA) );
+		set_this_variable( &stack->variables, CN.this );
+		Worker->control.mode = ExecutionMode;
+		Worker->control.stack = newItem( stack );
+		Worker->control.quiet = 1;
+		Worker->hcn.state = "";
+	}
+	Worker->frame.writes.policy = context->frame.writes.policy;
+	return Worker;
+}
+
+static void
+action_task( void *data, int index )
+{
+	ActionsVA *va = (ActionsVA *) data;
+	ActionTask *task = &va->tasks[ index ];
+	_context *context = worker_context( va->context );
+	FILE *stream = open_memstream( &task->output, &task->size );
+	setCurrentContext( context );
+	setOutputStream( stream );
+	context->frame.writes.writer = task->writer;
+	context->frame.writes.parallel = 1;
+	context->frame.writes.serial = 0;
+
+	long t = now();
+	perform_actions( task->instance, context );
+	task->time = now() - t;
+	if ( !context->frame.writes.serial )
+		traceSpan( "narrative", "actions", t, task->narrative->name );
+
+	task->serial = context->frame.writes.serial;
+	task->changes = context->frame.writes.log;
+	context->frame.writes.log = NULL;
+	context->frame.writes.writer = 0;
+	context->frame.writes.parallel = 0;
+	context->frame.writes.serial = 0;
+	context->error.flush_input = 0;
+	context->error.flush_output = 0;
+	setOutputStream( NULL );
+	setCurrentContext( NULL );
+	fclose( stream );
+}
+
+static void
+parallel_actions( _context *context )
+/*
+	performs the actions registered from last frame, when writes are
+	deferred, each narrative instance in its own task - see parallel_for()
+	- and in its thread's own context. The tasks hold their output and
+	changes, which are then written and logged in instance order. Tasks
+	which were refused a command - see serialOnly() - are undone instead,
+	and their instance run again on the main thread, also in order.
+*/
+{
+	int count = 0;
+	for ( listItem *i = context->narrative.registered; i!=NULL; i=i->next ) {
+		Narrative *narrative = (Narrative *) i->ptr;
+		for ( registryEntry *j = narrative->instances; j!=NULL; j=j->next )
+			if ((( Narrative *) j->value )->frame.actions != NULL ) count++;
+	}
+	if ( count == 0 )
+		return;
+
+	ActionTask *tasks = (ActionTask *) calloc( count, sizeof(ActionTask) );
+	int writer = 0;
+	count = 0;
+	for ( listItem *i = context->narrative.registered; i!=NULL; i=i->next )
+	{
+		Narrative *narrative = (Narrative *) i->ptr;
+		for ( registryEntry *j = narrative->instances; j!=NULL; j=j->next )
+		{
+			Narrative *n = (Narrative *) j->value;
+			writer++;
+			if ( n->frame.actions == NULL )
+				continue;
+			// frame.actions are LIFO - see execute_narrative_actions()
+			reorderListItem( &n->frame.actions );
+			ActionTask *task = &tasks[ count++ ];
+			task->entity = (Entity *) j->identifier;
+			task->narrative = narrative;
+			task->instance = n;
+			task->writer = writer;
+		}
+	}
+	ActionsVA va = { context, tasks };
+	parallel_for( count, action_task, &va );
+
+	for ( int i=0; i<count; i++ )
+	{
+		ActionTask *task = &tasks[ i ];
+		Narrative *n = task->instance;
+		if ( task->serial ) {
+			for ( listItem *j = task->changes; j!=NULL; j=j->next )
+				free( j->ptr );
+			freeListItem( &task->changes );
+			// frame.then was empty before the actions
+			for ( listItem *j = n->frame.then; j!=NULL; j=j->next )
+				((Occurrence *) j->ptr )->registered = 0;
+			freeListItem( &n->frame.then );
+			n->deactivate = 0;
+
+			context->frame.writes.writer = task->writer;
+			long t = now();
+			perform_actions( n, context );
+			task->time = now() - t;
+			traceSpan( "narrative", "actions", t, task->narrative->name );
+			context->frame.writes.writer = 0;
+		}
+		else {
+			fwrite( task->output, 1, task->size, stdout );
+			if ( task->changes != NULL )
+				context->frame.writes.log = catListItem( task->changes, context->frame.writes.log );
+		}
+		free( task->output );
+		freeListItem( &n->frame.actions );
+		record_narrative( task->narrative, task->time );
+		// check if the narrative reached 'exit'
+		if ( n->deactivate ) {
+			deactivateNarrative( task->entity, task->narrative );
+			listenersChanged( context );
+		}
+	}
+	free( tasks );
+}
+
 /*---------------------------------------------------------------------------
 	frame
 ---------------------------------------------------------------------------*/
 int
 systemFrame( char *state, int e, char **next_state, _context *context )
 {
+	if ( idle_frame( context ) )
+		return 0;
 #ifdef DEBUG
 	fprintf( stderr, "debug> entering systemFrame\n" );
 #endif
+	context->frame.pending.events = 0;
+	context->frame.pending.actions = 0;
+	long start = now(), phase = start;
+
 	// Check narratives to be deactivated - and deactivate them
 	for ( registryEntry *i = context->frame.log.narratives.deactivate; i!=NULL; i=i->next )
 	{
@@ -313,11 +1539,17 @@ systemFrame( char *state, int e, char **next_state, _context *context )
 			deactivateNarrative( (Entity *) j->ptr, narrative );
 		}
 		freeListItem( (listItem **) &i->value );
+		listenersChanged( context );
 	}
 	freeRegistry( &context->frame.log.narratives.deactivate );
+	record_phase( DeactivatePhase, &phase );
 
 	// perform actions registered from last frame, and update current conditions
-	for ( listItem *i = context->narrative.registered; i!=NULL; i=i->next )
+	// if writes are deferred, all instances see the database as of frame start
+	int writer = 0;
+	if (( context->frame.writes.policy != ImmediateWrites ) && !profilingExpressions() )
+		parallel_actions( context );
+	else for ( listItem *i = context->narrative.registered; i!=NULL; i=i->next )
 	{
 		Narrative *narrative = (Narrative *) i->ptr;
 		for ( registryEntry *j = narrative->instances; j!=NULL; j=j->next )
@@ -327,13 +1559,24 @@ systemFrame( char *state, int e, char **next_state, _context *context )
 #ifdef DEBUG
 			fprintf( stderr, "debug> systemFrame: invoking execute_narrative_actions()\n" );
 #endif
+			if ( context->frame.writes.policy != ImmediateWrites )
+				context->frame.writes.writer = ++writer;
+			long t = ( n->frame.actions != NULL ) ? now() : 0;
 			execute_narrative_actions( n, context );
+			if ( t ) {
+				record_narrative( narrative, now() - t );
+				traceSpan( "narrative", "actions", t, narrative->name );
+			}
+			context->frame.writes.writer = 0;
 			// check if the narrative reached 'exit'
 			if ( n->deactivate ) {
 				deactivateNarrative( e, narrative );
+				listenersChanged( context );
 			}
 		}
 	}
+	merge_changes( context );
+	record_phase( ActionsPhase, &phase );
 
 	// translate events registered last frame into new actions, based on current conditions
 	for ( listItem *i = context->narrative.registered; i!=NULL; i=i->next )
@@ -357,7 +1600,14 @@ systemFrame( char *state, int e, char **next_state, _context *context )
 		}
 	}
 
+	record_phase( TranslatePhase, &phase );
+
+	// the logs are at their fullest, and the actions' changes applied
+	updateMemoryPeaks( context );
+
 	// Transform latest occurrences into active narrative events, based on current conditions
+	compact_logs( context );
+	record( &FrameStats.log, log_size( context ) );
 	for ( listItem *i = context->narrative.registered; i!=NULL; i=i->next )
 	{
 		Narrative *narrative = (Narrative *) i->ptr;
@@ -377,10 +1627,7 @@ systemFrame( char *state, int e, char **next_state, _context *context )
 			freeListItem( &n->frame.then );
 		}
 	}
-	freeListItem( &context->frame.log.entities.instantiated );
-	freeListItem( &context->frame.log.entities.released );
-	freeListItem( &context->frame.log.entities.activated );
-	freeListItem( &context->frame.log.entities.deactivated );
+	notify_subscribers( context );
 
 	// Keep only those events which the upstream events allow
 	for ( listItem *i = context->narrative.registered; i!=NULL; i=i->next )
@@ -390,8 +1637,13 @@ systemFrame( char *state, int e, char **next_state, _context *context )
 		{
 			Narrative *n = (Narrative *) j->value;
 			filter_narrative_events( n, context );
+			if ( n->frame.events != NULL )
+				context->frame.pending.events = 1;
+			if ( n->frame.actions != NULL )
+				context->frame.pending.actions = 1;
 		}
 	}
+	record_phase( RegisterPhase, &phase );
 
 	// Check narratives to be activated - and activate them
 	for ( registryEntry *i = context->frame.log.narratives.activate; i!=NULL; i=i->next )
@@ -406,11 +1658,81 @@ systemFrame( char *state, int e, char **next_state, _context *context )
 #endif
 			Narrative *n = activateNarrative( e, narrative );
 			search_and_register_init( n, &n->root, context );
+			if ( n->frame.events != NULL )
+				context->frame.pending.events = 1;
 		}
 		freeListItem( (listItem **) &i->value );
+		listenersChanged( context );
 	}
 	freeRegistry( &context->frame.log.narratives.activate );
+	record_phase( ActivatePhase, &phase );
+	record( &FrameStats.phase[ FrameTotal ], phase - start );
+	traceSpan( "frame", "systemFrame", start, NULL );
+	FrameStats.frames++;
 
 	return 0;
 }
 
+
+unsigned long
+frameCount( void )
+/*
+	returns the number of frames run since start, regardless of resets
+*/
+{
+	return FrameStats.frames;
+}
+
+/*---------------------------------------------------------------------------
+	systemFrames
+---------------------------------------------------------------------------*/
+int
+systemFrames( _context *context )
+/*
+	each frame
+	1. executes the actions registered last frame
+	2. translates the events registered last frame into actions
+	3. translates this frame's changes into events
+	we run frames until the system settles, i.e. until a frame which started
+	without changes or events to process changed nothing - or until the cap
+	is reached. Thus cascades of narrative events complete - and output -
+	within the command which started them, while the actions of a narrative
+	condition which holds run once per frame, i.e. once for a command which
+	changed nothing. The memory pools are then compacted, see
+	compactMemory(), provided :compact keep enabled it - variables may
+	still refer to released entities, which compaction would unmap.
+	Returns the number of frames run.
+*/
+{
+	int count = 0;
+	while ( !idle_frame( context ) ) {
+		if ( count == context->frame.cap ) {
+			fprintf( stderr, "consensus> Warning: system did not settle within %d frames\n", count );
+			break;
+		}
+		int settled = settled_frame( context );
+		systemFrame( base, 0, &same, context );
+		count++;
+		if ( settled && settled_frame( context ) )
+			break;
+	}
+	if (( count > 0 ) && ( context->memory.keep >= 0 ))
+		compactMemory( context->memory.keep );
+	return count;
+}
+
+/*---------------------------------------------------------------------------
+	commitBatch
+---------------------------------------------------------------------------*/
+int
+commitBatch( _context *context )
+/*
+	ends batch mode. The changes logged in the meantime - coalesced, see
+	logEntity() - are then processed all at once by the next frames.
+*/
+{
+	if ( !context->frame.batch )
+		return 0;
+	context->frame.batch = 0;
+	return 1;
+}
@@ -7,9 +7,23 @@
 
 _action	systemFrame;
 
+#define FRAME_CAP	64
+
 /*---------------------------------------------------------------------------
 	frame utilities	- public
 ---------------------------------------------------------------------------*/
 
+int	setWritePolicy( char *policy, _context *context );
+void	logEntity( EventType type, Entity *e, _context *context );
+int	deferChanges( ExpressionMode mode, listItem *entities, _context *context );
+int	serialOnly( _context *context );
+void	watchQuery( StandingQuery *query, _context *context );
+void	listenersChanged( _context *context );
+int	systemFrames( _context *context );
+int	commitBatch( _context *context );
+void	outputFrameStats( FILE *stream, int buckets );
+void	resetFrameStats( void );
+unsigned long	frameCount( void );
+
 
 #endif	// FRAME_H
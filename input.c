@@ -11,6 +11,9 @@
 #include "input.h"
 #include "hcn.h"
 #include "output.h"
+#include "server.h"
+#include "trace.h"
+#include "replay.h"
 
 // #define DEBUG
 
@@ -109,6 +112,7 @@ push_input( char *identifier, void *src, InputType type, _context *context )
 	switch ( type ) {
 	case PipeInput:
 	case HCNFileInput:
+	case FileInput:
 		// check if stream is already in use
 		; registryEntry *stream = lookupByName( context->input.stream, identifier );
 		if ( stream != NULL ) {
@@ -124,7 +128,9 @@ push_input( char *identifier, void *src, InputType type, _context *context )
 		input = (StreamVA *) calloc( 1, sizeof(StreamVA) );
 		input->level = context->control.level;
 		input->type = type;
-		input->ptr.file = ( type == PipeInput ) ?
+		if ( replayStream( identifier, type, &input->ptr.file ) )
+			input->mode.buffered = 1;
+		else input->ptr.file = ( type == PipeInput ) ?
 			popen( identifier, "r" ) :
 			fopen( identifier, "r " );
 		if ( input->ptr.file == NULL ) {
@@ -135,6 +141,8 @@ push_input( char *identifier, void *src, InputType type, _context *context )
 		}
 		context->hcn.state = base;
 		registerByName( &context->input.stream, identifier, input );
+		input->trace.start = traceClock();
+		if ( input->trace.start ) input->trace.name = strdup( identifier );
 		break;
 	default:
 		if ( identifier != NULL ) {
@@ -173,6 +181,9 @@ push_input( char *identifier, void *src, InputType type, _context *context )
 				input->mode.api = 1;
 				input->ptr.string = src;
 				break;
+			case StringInput:
+				input->ptr.string = src;
+				break;
 			default: break;
 		}
 		if ( identifier != NULL ) {
@@ -198,6 +209,38 @@ push_input( char *identifier, void *src, InputType type, _context *context )
 	return 0;
 }
 
+/*---------------------------------------------------------------------------
+	queue_input
+---------------------------------------------------------------------------*/
+void
+queue_input( char *path, char *command, _context *context )
+/*
+	queues either the script file at path - which the input then owns - or
+	the '\n'-terminated command string, to be read in turn once the input
+	stack is empty, instead of stdin. See input().
+*/
+{
+	registryEntry *entry = newRegistryItem( path, command ), *last;
+	if ( context->input.queue == NULL )
+		context->input.queue = entry;
+	else {
+		for ( last = context->input.queue; last->next!=NULL; last=last->next );
+		last->next = entry;
+	}
+}
+
+static void
+dequeue_input( _context *context )
+{
+	registryEntry *entry = context->input.queue;
+	context->input.queue = entry->next;
+	if ( entry->identifier != NULL )
+		push_input( entry->identifier, NULL, FileInput, context );
+	else
+		push_input( NULL, entry->value, StringInput, context );
+	freeRegistryItem( entry );
+}
+
 /*---------------------------------------------------------------------------
 	pop_input
 ---------------------------------------------------------------------------*/
@@ -212,6 +255,11 @@ pop_input( char *state, int event, char **next_state, _context *context )
 	}
 	else event = 0;
 
+	if ( input->trace.start ) {
+		traceSpan( "input", ( input->type == PipeInput ) ? "pipe" : ( input->type == FileInput ) ? "file" : "hcn",
+			input->trace.start, input->trace.name );
+		free( input->trace.name );
+	}
 	free( input );
 	popListItem( &context->input.stack );
 
@@ -270,10 +318,31 @@ input( char *state, int event, char **next_state, _context *context )
 	do {
 		if ( context->input.stack == NULL )
 		{
-			if ( !strcmp( state, base ) ) prompt( context );
-			event = getchar( );
-            if( event == EOF )
-                exit( EXIT_SUCCESS );
+			if ( context->input.server ) {
+				event = server_getc( state, context );
+			}
+			else if ( context->input.queue != NULL ) {
+				dequeue_input( context );
+				continue;
+			}
+			else if ( context->input.eof ) {
+				// input ended in the middle of a command
+				raise_error( context, 0, "reached premature end of input" );
+				exit( EXIT_FAILURE );	// see end_session() in main.c
+			}
+			else {
+				if ( context->input.headless )
+					event = EOF;
+				else {
+					if ( !strcmp( state, base ) ) prompt( context );
+					event = replayGetchar( );
+				}
+				if ( event == EOF ) {
+					// completes the last command - see read_command()
+					context->input.eof = 1;
+					event = '\n';
+				}
+			}
 			if ( event == '\n' ) context->control.prompt = 1;
 		}
 		else
@@ -285,7 +354,7 @@ input( char *state, int event, char **next_state, _context *context )
 				if ( stream->position == NULL ) {
 					if ( stream->mode.instructions && context->narrative.mode.output ) {
 						for ( int i=0; i<=context->control.level; i++ )
-							printf( "\t" );
+							outputf( "\t" );
 					}
 					stream->position = stream->ptr.string;
 #ifdef DEBUG
@@ -294,7 +363,7 @@ input( char *state, int event, char **next_state, _context *context )
 				}
 				event = (int ) (( char *) stream->position++ )[ 0 ];
 				if ( event && ( context->narrative.mode.output )) {
-					printf( "%c", event );
+					outputf( "%c", event );
 				}
 				do_pop = ( event == 0 );
 				break;
@@ -310,6 +379,7 @@ input( char *state, int event, char **next_state, _context *context )
 				do_pop = ( event == EOF );
 				break;
 			case PipeInput:
+			case FileInput:
 				event = fgetc( stream->ptr.file );
 				do_pop = ( event == EOF );
 				break;
@@ -355,7 +425,10 @@ input( char *state, int event, char **next_state, _context *context )
 					deregisterByValue( &context->input.stream, stream );
 					break;
 				case PipeInput:
-					pclose( stream->ptr.file );
+				case FileInput:
+					if (( stream->type == PipeInput ) && !stream->mode.buffered )
+						pclose( stream->ptr.file );
+					else fclose( stream->ptr.file );
 					registryEntry *entry = lookupByValue( context->input.stream, stream );
 					free( entry->identifier );
 					deregisterByValue( &context->input.stream, stream );
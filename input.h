@@ -18,6 +18,7 @@ _action	read_va_identifier;
 void	set_input_mode( RecordMode mode, int event, _context *context );
 int	push_input( char *identifier, void *src, InputType type, _context *context );
 void	set_input( listItem *src, _context *context );
+void	queue_input( char *path, char *command, _context *context );
 int	pop_input( char *state, int event, char **next_state, _context *context );
 void	freeInstructionBlock( _context *context );
 
@@ -14,13 +14,34 @@
 
 // #define DEBUG
 
+/*---------------------------------------------------------------------------
+	currentContext	- utility
+---------------------------------------------------------------------------*/
+static __thread _context *Current = NULL;
+
+_context *
+currentContext( void )
+/*
+	returns the calling thread's context, i.e. CN.context, but for the
+	threads running narrative actions - see parallel_actions() in frame.c
+*/
+{
+	return ( Current != NULL ) ? Current : CN.context;
+}
+
+void
+setCurrentContext( _context *context )
+{
+	Current = context;
+}
+
 /*---------------------------------------------------------------------------
 	context_check	- utility
 ---------------------------------------------------------------------------*/
 int
 context_check( int freeze, int instruct, int execute )
 {
-	int mode = CN.context->control.mode;
+	int mode = currentContext()->control.mode;
 	switch ( mode ) {
 	case FreezeMode:
 		return freeze;
@@ -49,7 +70,7 @@ set_control_mode( ControlMode mode, int event, _context *context )
 		set_input_mode( RecordInstructionMode, event, context );
 		break;
 	case ExecutionMode:
-		if (( context->control.mode == FreezeMode ) && ( context->input.stack == NULL )) {
+		if (( context->control.mode == FreezeMode ) && ( context->input.stack == NULL ) && !context->control.quiet ) {
 			fprintf( stderr, "consensus> back to active mode\n" );
 		}
 		set_input_mode( OffRecordMode, event, context );
@@ -66,7 +87,12 @@ raise_error( _context *context, int event, char *message )
 {
 	context->error.flush_input = !(( event == '\n' ) || ( event == 0 ));
     context->error.code = EXIT_FAILURE;
-	if ( message != NULL ) {
+	context->error.count++;
+	if ( context->frame.writes.parallel ) {
+		// reported when the instance runs again - see serialOnly() in frame.c
+		context->frame.writes.serial = 1;
+	}
+	else if ( message != NULL ) {
 		// must flush output on stdout
 		if ( context->error.flush_output ) {
 			printf( "***** Error: " );
@@ -130,7 +156,9 @@ warning( char *state, int event, char **next_state, _context *context )
 	if ( !context_check( 0, InstructionMode, ExecutionMode ) )
 		return 0;
 
-	if ( event == '\n' ) {
+	if ( context->frame.writes.parallel ) {
+		context->frame.writes.serial = 1;
+	} else if ( event == '\n' ) {
 		fprintf( stderr, "consensus> Warning: \"%s\", instruction incomplete\n", state );
 	} else if ( event != 0 ) {
 		fprintf( stderr, "consensus> Warning: syntax error: in \"%s\", on '%c'\n", state, event );
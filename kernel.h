@@ -31,6 +31,7 @@ typedef enum {
 	StreamInput,	// default: read from stdin
 	HCNFileInput,
 	PipeInput,
+	FileInput,	// script file, read directly - see main.c
 	StringInput,
 	InstructionBlock,
 	LastInstruction,
@@ -79,6 +80,14 @@ typedef enum {
 }
 ExpressionMode;
 
+typedef enum {
+	ImmediateWrites = 0,	// default: actions write to the database at once
+	LastWriterWins,
+	FirstWriterWins,
+	DropConflicts
+}
+WritePolicy;
+
 typedef enum {
 	ConditionOccurrence = 1,
 	EventOccurrence,
@@ -124,6 +133,7 @@ typedef struct _Expression {
 }
 Expression;
 typedef struct _ExpressionSub ExpressionSub;
+typedef struct _Cursor Cursor;	// see expression_solve.c
 
 // Narrative
 // --------------------------------------------------
@@ -191,6 +201,7 @@ typedef struct {
 	Registry instances;	// { ( entity, narrative-instance ) }
 	unsigned int deactivate : 1;
 	unsigned int assigned : 1;
+	unsigned int release : 1;	// holds release events
 }
 Narrative;
 
@@ -213,6 +224,7 @@ typedef struct {
 		unsigned int api : 1;
 		unsigned int variable : 1;
 		unsigned int pop : 1;
+		unsigned int buffered : 1;	// see replayStream()
 	}
 	mode;
 	union {
@@ -220,6 +232,10 @@ typedef struct {
 		char *string;
 	} ptr;
 	char *position;
+	struct {
+		long start;	// if tracing - see trace.c
+		char *name;
+	} trace;
 }
 StreamVA;
 
@@ -275,6 +291,86 @@ typedef struct {
 }
 StackVA;
 
+// Subscription
+// --------------------------------------------------
+
+typedef void _callback( EventType type, listItem *changes, void *user_data );
+
+typedef struct {
+	EventType type;
+	Expression *filter;	// optional - owned by the subscriber
+	_callback *callback;
+	void *user_data;
+	unsigned int cancelled : 1;	// unsubscribed during notification
+}
+Subscription;
+
+// Change - deferred write
+// --------------------------------------------------
+
+typedef struct {
+	EventType type;
+	Entity *entity;
+	int writer;	// sequence number of the narrative instance
+}
+Change;
+
+// StandingQuery
+// --------------------------------------------------
+
+typedef void _delta( listItem *added, listItem *removed, void *user_data );
+
+typedef struct {
+	Expression *expression;	// owned by the watcher
+	Registry results;	// { ( entity, entity-expression ) }
+	struct {
+		listItem *names;	// { identifier } which any change must involve
+		unsigned int any : 1;	// any change may affect the results
+		unsigned int states : 1;	// any state change may affect them
+	} terms;		// see query_terms() in frame.c
+	unsigned int touched : 1;	// by the current frame's changes
+	_delta *callback;
+	void *user_data;
+}
+StandingQuery;
+
+// Native
+// --------------------------------------------------
+
+typedef int _native( int argc, Entity **argv[], void *user_data );
+
+typedef struct {
+	_native *action;
+	void *user_data;
+}
+NativeVA;
+
+// Memory - see memory.c
+// --------------------------------------------------
+
+typedef enum {
+	EntityMemory,
+	RelationMemory,
+	AccountMemory,
+	NarrativeMemory,
+	VariableMemory,
+	LogMemory,
+	ExpressionMemory,
+	MemorySubsystems
+}
+MemorySubsystem;
+
+typedef struct {
+	PoolStats entities, items, registry;	// recycled through free lists
+	struct {
+		long expressions, occurrences, narratives, stacks, variables;
+	} live;				// objects found in use
+	long bytes[ MemorySubsystems ];
+	long peak[ MemorySubsystems ];	// highest of the bytes reported so far
+	long heap;			// bytes malloc'd and in use, -1 if unknown
+}
+MemoryStats;
+
 // Context
 // --------------------------------------------------
 
@@ -284,6 +380,7 @@ typedef struct {
 		listItem *stack;	// current StackVA
 		int level;
 		unsigned int prompt : 1;
+		unsigned int quiet : 1;		// no prompt nor echo
 		unsigned int contrary : 1;
 		unsigned int output : 1;
 	} control;
@@ -295,6 +392,10 @@ typedef struct {
 		registryEntry *stream;
 		registryEntry *string;
 		listItem *instruction;
+		Registry queue;		// { ( script, command ) } see queue_input()
+		unsigned int server : 1;
+		unsigned int headless : 1;	// input ends with the queue - no stdin
+		unsigned int eof : 1;		// see read_command()
 	} input;
 	struct {
 		int level;
@@ -320,6 +421,8 @@ typedef struct {
 		Expression *ptr;
 		listItem *stack;
 		int marked;
+		int exist;	// existence only - see expression_solve()
+		listItem *cursors;	// { open cursor }
 	} expression;
 	struct {
 		int level;
@@ -348,20 +451,50 @@ typedef struct {
 		struct {
 			struct {
 				listItem *instantiated;	// { entity }
-				listItem *released;	// { entity-expression }
+				listItem *released;	// { flat literal } - see logEntity()
+				listItem *literals;	// released, expanded on demand
+				int releases;		// whether logged or not
 				listItem *activated;	// { entity }
 				listItem *deactivated;	// { entity }
+				listItem *unwatched;	// { released query result }
 			} entities;
 			struct {
 				Registry activate;	// { ( narrative, { entity } ) }
 				Registry deactivate;	// { ( narrative, { entity } ) }
 			} narratives;
 		} log;
+		listItem *subscribers;	// { subscription }
+		int notifying;	// nesting level of notify_subscribers()
+		listItem *queries;	// { standing query }
+		struct {
+			unsigned int known : 1;
+			unsigned int value : 1;
+		} listened;	// see release_listened()
+		struct {
+			WritePolicy policy;
+			listItem *log;	// { change }
+			int writer;	// 0: not deferring
+			unsigned int parallel : 1;	// see serialOnly()
+			unsigned int serial : 1;
+		} writes;
+		struct {
+			unsigned int events : 1;
+			unsigned int actions : 1;
+		} pending;	// narrative events or actions left for the next frame
+		int cap;	// maximum number of frames per command
+		unsigned int batch : 1;	// frames on hold until commit
 	} frame;
+	struct {
+		listItem *args;		// { variable identifier }
+	} native;
+	struct {
+		long keep;	// empty slabs kept per pool after frames, or -1 - see memory.c
+	} memory;
 	struct {
 		unsigned int flush_input;
 		unsigned int flush_output;
         int code;
+		int count;	// errors raised so far
 	} error;
 }
 _context;
@@ -378,6 +511,7 @@ extern
 		listItem *DB;
 		Registry VB;		// registry of value accounts
 		Registry registry;	// registry of named entities
+		Registry natives;	// registry of native actions
 	} CN;
 
 /*---------------------------------------------------------------------------
@@ -434,6 +568,8 @@ _action	warning;
 int raise_error( _context *context, int event, char *message );
 void set_control_mode( ControlMode mode, int event, _context *context );
 int context_check( int freeze, int instruct, int execute );
+_context *currentContext( void );
+void setCurrentContext( _context *context );
 
 
 #endif	// KERNEL_H
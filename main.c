@@ -1,7 +1,10 @@
+#define _GNU_SOURCE	// asprintf
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <unistd.h>
+#include <errno.h>
 
 #include "database.h"
 #include "registry.h"
@@ -9,41 +12,116 @@
 
 #include "api.h"
 #include "command.h"
-#include "variables.h"
+#include "input.h"
+#include "server.h"
+#include "trace.h"
+#include "replay.h"
 
 // #define DEBUG
 
 /*---------------------------------------------------------------------------
 	main
 ---------------------------------------------------------------------------*/
-int
-main( int argc, char ** argv )
+static int
+end_session( void )
+/*
+	commits the frames held in batch mode, then completes the session's
+	record or replay - returns the exit status
+*/
 {
-	_context context;
-	bzero( &context, sizeof(_context) );
-	CN.context = &context;
-
-	CN.this = newEntity( NULL, NULL, NULL );
-	CN.nil = newEntity( NULL, NULL, NULL );
-	CN.nil->sub[0] = CN.nil;
-	CN.nil->sub[1] = CN.nil;
-	CN.nil->sub[2] = CN.nil;
-	CN.nil->state = 1;	// always on
-
-	StackVA stack;
-	bzero( &stack, sizeof(StackVA) );
-	set_this_variable( &stack.variables, CN.this );
-
-	registerByName( &CN.VB, "name", NULL );
-	registerByName( &CN.VB, "hcn", NULL );
-	registerByName( &CN.VB, "url", NULL );
-	registerByName( &CN.VB, "narratives", NULL );
+	if ( CN.context->frame.batch ) cn_commit();
+	return replayEnd();
+}
 
-	context.control.mode = ExecutionMode;
-	context.control.stack = newItem( &stack );
-	context.control.prompt = 1;
-	context.hcn.state = "";
+static void
+end_session_at_exit( void )
+/*
+	in case the input ends in the middle of a command - see input()
+*/
+{
+	end_session();
+}
 
-	return read_command( base, 0, &same, &context );
+static int
+usage( char *name )
+{
+	fprintf( stderr, "usage: %s [ --batch ] [ --server port|path ] [ --trace file ]\n"
+		"\t[ --record file | --replay file [ --timing ] ] [ -q | --quiet ]\n"
+		"\t[ -e command | script ]...\n", name );
+	return EXIT_FAILURE;
 }
 
+int
+main( int argc, char ** argv )
+{
+	cn_init();
+	int timing = 0;
+	char *replay = NULL;
+	for ( int i=1; i<argc; i++ ) {
+		if ( !strcmp( argv[ i ], "--batch" ) ) {
+			// hold frames until :commit or end of input
+			cn_batch();
+		}
+		else if ( !strcmp( argv[ i ], "--server" ) && ( i + 1 < argc )) {
+			// listen on loopback port or Unix socket path
+			if ( server_init( argv[ ++i ], CN.context ) < 0 )
+				return EXIT_FAILURE;
+		}
+		else if ( !strcmp( argv[ i ], "--trace" ) && ( i + 1 < argc )) {
+			// write a Chrome trace of the engine's activity
+			if ( traceOpen( argv[ ++i ] ) < 0 ) {
+				perror( "consensus> trace" );
+				return EXIT_FAILURE;
+			}
+		}
+		else if ( !strcmp( argv[ i ], "--record" ) && ( i + 1 < argc )) {
+			// record the session's input and output hash - see replay.c
+			if ( replayRecord( argv[ ++i ] ) < 0 ) {
+				perror( "consensus> record" );
+				return EXIT_FAILURE;
+			}
+		}
+		else if ( !strcmp( argv[ i ], "--replay" ) && ( i + 1 < argc )) {
+			replay = argv[ ++i ];
+		}
+		else if ( !strcmp( argv[ i ], "--timing" ) ) {
+			// with --replay: hide the output, and report the timings
+			timing = 1;
+		}
+		else if ( !strcmp( argv[ i ], "-q" ) || !strcmp( argv[ i ], "--quiet" ) ) {
+			// no prompt, no echo, and no question asked
+			CN.context->control.quiet = 1;
+		}
+		else if ( !strcmp( argv[ i ], "-e" ) && ( i + 1 < argc )) {
+			// execute command, then exit
+			char *command;
+			asprintf( &command, "%s\n", argv[ ++i ] );
+			queue_input( NULL, command, CN.context );
+		}
+		else if ( argv[ i ][ 0 ] != '-' ) {
+			// execute script file, then exit
+			if ( access( argv[ i ], R_OK ) < 0 ) {
+				fprintf( stderr, "consensus> %s: %s\n", argv[ i ], strerror( errno ));
+				return EXIT_FAILURE;
+			}
+			queue_input( strdup( argv[ i ] ), NULL, CN.context );
+		}
+		else return usage( argv[ 0 ] );
+	}
+	if ( replay != NULL ) {
+		// replace stdin with the recorded session
+		if ( replayOpen( replay, timing ) < 0 )
+			return EXIT_FAILURE;
+	}
+	if ( CN.context->input.queue != NULL ) {
+		// headless: no stdin, no prompt
+		CN.context->control.quiet = 1;
+		CN.context->input.headless = 1;
+	}
+	atexit( end_session_at_exit );
+	read_command( base, 0, &same, CN.context );
+	int status = end_session();
+	if ( CN.context->input.headless && CN.context->error.count )
+		status = EXIT_FAILURE;
+	return status;
+}
@@ -0,0 +1,392 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include "database.h"
+#include "registry.h"
+#include "kernel.h"
+
+#include "api.h"
+#include "memory.h"
+#include "slab.h"
+
+// #define DEBUG
+
+/*---------------------------------------------------------------------------
+	memory accounting
+---------------------------------------------------------------------------*/
+/*
+	The objects allocated from slab pools - entities, listItems and
+	registry entries - are counted as they come and go, see slab.c.
+	Everything else is accounted for by walking the structures which hold
+	it, and attributing each object to the subsystem holding it:
+		entities	base entities, and their names
+		relations	relationship instances, and their as_sub links
+		accounts	value accounts, and their strings, and natives
+		narratives	narratives, instances and occurrences
+		variables	stacks and variables
+		logs		frame logs, deferred changes, subscriptions
+				and standing queries
+		expressions	expressions, wherever these are held
+	Expressions shared between holders - e.g. between a narrative and its
+	instances - are counted once. The subsystems' peaks are updated upon
+	request and after each frame, see updateMemoryPeaks().
+*/
+typedef struct {
+	MemoryStats *stats;
+	listItem *expressions;	// { expression } counted already
+}
+Walk;
+
+static long Peak[ MemorySubsystems ];
+
+static long
+string_size( char *string )
+{
+	return ( string == NULL ) ? 0 : strlen( string ) + 1;
+}
+
+static long
+list_size( listItem *list )
+{
+	long size = 0;
+	for ( listItem *i = list; i!=NULL; i=i->next )
+		size += sizeof(listItem);
+	return size;
+}
+
+static long
+registry_size( Registry registry )
+{
+	long size = 0;
+	for ( registryEntry *r = registry; r!=NULL; r=r->next )
+		size += sizeof(registryEntry);
+	return size;
+}
+
+/*---------------------------------------------------------------------------
+	walk utilities
+---------------------------------------------------------------------------*/
+static void
+walk_expression( Expression *expression, Walk *walk )
+{
+	if (( expression == NULL ) || ( addIfNotThere( &walk->expressions, expression ) == NULL ))
+		return;
+	MemoryStats *stats = walk->stats;
+	stats->live.expressions++;
+	stats->bytes[ ExpressionMemory ] += sizeof(Expression);
+	ExpressionSub *sub = expression->sub;
+	for ( int i=0; i<4; i++ ) {
+		if ( sub[ i ].result.any || sub[ i ].result.none )
+			continue;
+		walk_expression( sub[ i ].e, walk );
+		char *identifier = sub[ i ].result.identifier.value;
+		switch ( sub[ i ].result.identifier.type ) {
+		case VariableIdentifier:
+			if (( identifier == variator_symbol ) || ( identifier == this_symbol ))
+				break;
+		case DefaultIdentifier:
+			stats->bytes[ ExpressionMemory ] += string_size( identifier );
+		default:
+			break;
+		}
+	}
+}
+
+static void
+walk_variables( Registry variables, Walk *walk )
+{
+	MemoryStats *stats = walk->stats;
+	long *bytes = &stats->bytes[ VariableMemory ];
+	for ( registryEntry *r = variables; r!=NULL; r=r->next ) {
+		VariableVA *variable = (VariableVA *) r->value;
+		stats->live.variables++;
+		*bytes += sizeof(registryEntry) + sizeof(VariableVA);
+		if (( r->identifier != variator_symbol ) && ( r->identifier != this_symbol ))
+			*bytes += string_size( r->identifier );
+		if ( variable->data.ref )
+			continue;
+		switch ( variable->type ) {
+		case EntityVariable:
+			*bytes += list_size( variable->data.value );
+			break;
+		case ExpressionVariable:
+			*bytes += list_size( variable->data.value );
+			walk_expression( ((listItem *) variable->data.value )->ptr, walk );
+			break;
+		case LiteralVariable:
+			*bytes += list_size( variable->data.value );
+			for ( listItem *i = variable->data.value; i!=NULL; i=i->next )
+				walk_expression( ((ExpressionSub *) i->ptr )->e, walk );
+			break;
+		case NarrativeVariable:
+			*bytes += registry_size( variable->data.value );
+			break;
+		}
+	}
+}
+
+static void
+walk_occurrence( Occurrence *occurrence, int master, Walk *walk )
+/*
+	instances' occurrences share their master's - whose expressions and
+	instructions are counted only once, with the master
+*/
+{
+	MemoryStats *stats = walk->stats;
+	long *bytes = &stats->bytes[ NarrativeMemory ];
+	if ( master ) switch ( occurrence->type ) {
+	case ConditionOccurrence:
+		walk_expression( occurrence->va.condition.expression, walk );
+		break;
+	case EventOccurrence:
+		*bytes += string_size( occurrence->va.event.identifier.name );
+		walk_expression( occurrence->va.event.expression, walk );
+		break;
+	case ActionOccurrence:
+		for ( listItem *i = occurrence->va.action.instructions; i!=NULL; i=i->next )
+			*bytes += sizeof(listItem) + string_size( i->ptr );
+		break;
+	case ThenOccurrence:
+		break;
+	}
+	for ( listItem *i = occurrence->sub.n; i!=NULL; i=i->next ) {
+		stats->live.occurrences++;
+		*bytes += sizeof(listItem) + sizeof(Occurrence);
+		walk_occurrence( i->ptr, master, walk );
+	}
+}
+
+static void
+walk_narrative( Narrative *narrative, int master, Walk *walk )
+{
+	MemoryStats *stats = walk->stats;
+	long *bytes = &stats->bytes[ NarrativeMemory ];
+	stats->live.narratives++;
+	*bytes += sizeof(Narrative);
+	if ( master ) *bytes += string_size( narrative->name );
+	*bytes += list_size( narrative->frame.events );
+	*bytes += list_size( narrative->frame.actions );
+	*bytes += list_size( narrative->frame.then );
+	*bytes += registry_size( narrative->entities );
+	*bytes += registry_size( narrative->instances );
+	walk_occurrence( &narrative->root, master, walk );
+	walk_variables( narrative->variables, walk );
+}
+
+/*---------------------------------------------------------------------------
+	walk subsystems
+---------------------------------------------------------------------------*/
+static void
+walk_database( Walk *walk )
+{
+	long *bytes = walk->stats->bytes;
+	for ( listItem *i = CN.DB; i!=NULL; i=i->next ) {
+		Entity *e = (Entity *) i->ptr;
+		int links = ( e->sub[ 0 ] != NULL ) + ( e->sub[ 1 ] != NULL ) + ( e->sub[ 2 ] != NULL );
+		if ( links == 0 )
+			bytes[ EntityMemory ] += sizeof(listItem) + sizeof(Entity);
+		else
+			bytes[ RelationMemory ] += sizeof(listItem) + sizeof(Entity) + links * sizeof(listItem);
+	}
+	for ( registryEntry *r = CN.registry; r!=NULL; r=r->next )
+		bytes[ EntityMemory ] += sizeof(registryEntry) + string_size( r->identifier );
+}
+
+static void
+walk_accounts( Walk *walk )
+/*
+	the name account's strings are those of CN.registry, already counted.
+	Narratives are walked once each, however many entities they belong to.
+*/
+{
+	long *bytes = &walk->stats->bytes[ AccountMemory ];
+	listItem *narratives = NULL;
+	for ( registryEntry *va = CN.VB; va!=NULL; va=va->next ) {
+		*bytes += sizeof(registryEntry) + string_size( va->identifier );
+		int narrative = !strcmp( va->identifier, "narratives" );
+		int strings = !narrative && strcmp( va->identifier, "name" );
+		for ( registryEntry *r = va->value; r!=NULL; r=r->next ) {
+			*bytes += sizeof(registryEntry);
+			if ( strings )
+				*bytes += string_size( r->value );
+			else if ( narrative ) {
+				*bytes += registry_size( r->value );
+				for ( registryEntry *j = r->value; j!=NULL; j=j->next )
+					addIfNotThere( &narratives, j->value );
+			}
+		}
+	}
+	for ( listItem *i = narratives; i!=NULL; i=i->next ) {
+		Narrative *narrative = (Narrative *) i->ptr;
+		walk_narrative( narrative, 1, walk );
+		for ( registryEntry *r = narrative->instances; r!=NULL; r=r->next )
+			if ( r->value != narrative )
+				walk_narrative( r->value, 0, walk );
+	}
+	freeListItem( &narratives );
+	for ( registryEntry *r = CN.natives; r!=NULL; r=r->next )
+		*bytes += sizeof(registryEntry) + string_size( r->identifier ) + sizeof(NativeVA);
+}
+
+static void
+walk_stack( _context *context, Walk *walk )
+{
+	MemoryStats *stats = walk->stats;
+	for ( listItem *i = context->control.stack; i!=NULL; i=i->next ) {
+		StackVA *stack = (StackVA *) i->ptr;
+		stats->live.stacks++;
+		stats->bytes[ VariableMemory ] += sizeof(listItem) + sizeof(StackVA);
+		stats->bytes[ VariableMemory ] += list_size( stack->loop.index );
+		walk_variables( stack->variables, walk );
+	}
+	walk_expression( context->expression.ptr, walk );
+}
+
+static void
+walk_logs( _context *context, Walk *walk )
+{
+	long *bytes = &walk->stats->bytes[ LogMemory ];
+	*bytes += list_size( context->frame.log.entities.instantiated );
+	*bytes += list_size( context->frame.log.entities.activated );
+	*bytes += list_size( context->frame.log.entities.deactivated );
+	*bytes += list_size( context->frame.log.entities.unwatched );
+	for ( listItem *i = context->frame.log.entities.released; i!=NULL; i=i->next )
+		*bytes += sizeof(listItem) + string_size( i->ptr );
+	*bytes += list_size( context->frame.log.entities.literals );
+	for ( listItem *i = context->frame.log.entities.literals; i!=NULL; i=i->next )
+		walk_expression( ((ExpressionSub *) i->ptr )->e, walk );
+
+	Registry log[ 2 ] = {
+		context->frame.log.narratives.activate,
+		context->frame.log.narratives.deactivate
+	};
+	for ( int n=0; n<2; n++ )
+		for ( registryEntry *r = log[ n ]; r!=NULL; r=r->next )
+			*bytes += sizeof(registryEntry) + list_size( r->value );
+
+	for ( listItem *i = context->frame.writes.log; i!=NULL; i=i->next )
+		*bytes += sizeof(listItem) + sizeof(Change);
+	for ( listItem *i = context->frame.subscribers; i!=NULL; i=i->next ) {
+		*bytes += sizeof(listItem) + sizeof(Subscription);
+		walk_expression( ((Subscription *) i->ptr )->filter, walk );
+	}
+	for ( listItem *i = context->frame.queries; i!=NULL; i=i->next ) {
+		StandingQuery *query = (StandingQuery *) i->ptr;
+		*bytes += sizeof(listItem) + sizeof(StandingQuery) + registry_size( query->results );
+		*bytes += list_size( query->terms.names );
+		walk_expression( query->expression, walk );
+		for ( registryEntry *r = query->results; r!=NULL; r=r->next )
+			walk_expression( r->value, walk );
+	}
+}
+
+/*---------------------------------------------------------------------------
+	memoryStats
+---------------------------------------------------------------------------*/
+static void
+walk_memory( MemoryStats *stats, _context *context )
+{
+	Walk walk = { stats, NULL };
+	walk_database( &walk );
+	walk_accounts( &walk );
+	walk_stack( context, &walk );
+	walk_logs( context, &walk );
+	freeListItem( &walk.expressions );
+
+	for ( int i=0; i<MemorySubsystems; i++ ) {
+		if ( stats->bytes[ i ] > Peak[ i ] )
+			Peak[ i ] = stats->bytes[ i ];
+		stats->peak[ i ] = Peak[ i ];
+	}
+}
+
+void
+memoryStats( MemoryStats *stats, _context *context )
+{
+	memset( stats, 0, sizeof(MemoryStats) );
+	entityPoolStats( &stats->entities );
+	itemPoolStats( &stats->items );
+	registryPoolStats( &stats->registry );
+	walk_memory( stats, context );
+#if defined( __GLIBC__ ) && (( __GLIBC__ > 2 ) || ( __GLIBC_MINOR__ >= 33 ))
+	stats->heap = mallinfo2().uordblks;
+#else
+	stats->heap = -1;
+#endif
+}
+
+/*---------------------------------------------------------------------------
+	updateMemoryPeaks
+---------------------------------------------------------------------------*/
+void
+updateMemoryPeaks( _context *context )
+/*
+	invoked by each frame - see systemFrame() - so that the peaks
+	reported are high-water marks at frame granularity, rather than
+	samples taken whenever memoryStats() was invoked
+*/
+{
+	MemoryStats stats;
+	memset( &stats, 0, sizeof(MemoryStats) );
+	walk_memory( &stats, context );
+}
+
+/*---------------------------------------------------------------------------
+	outputMemoryStats
+---------------------------------------------------------------------------*/
+static char *subsystem_name[ MemorySubsystems ] = {
+	"entities", "relations", "accounts", "narratives", "variables", "logs", "expressions"
+};
+
+static void
+output_pool( FILE *stream, char *name, PoolStats *pool )
+{
+	fprintf( stream, "%-12s %12ld %12ld %12ld %12ld %12ld %12ld\n", name, pool->live, pool->free,
+		pool->peak, pool->slabs, pool->empty, pool->slabs * SLAB_SIZE );
+}
+
+void
+outputMemoryStats( FILE *stream, _context *context )
+{
+	MemoryStats stats;
+	memoryStats( &stats, context );
+
+	fprintf( stream, "%-12s %12s %12s %12s %12s %12s %12s\n", "pool", "live", "free", "peak", "slabs", "empty", "bytes" );
+	output_pool( stream, "entities", &stats.entities );
+	output_pool( stream, "listItems", &stats.items );
+	output_pool( stream, "registry", &stats.registry );
+
+	long total = 0, peak = 0;
+	fprintf( stream, "%-12s %12s %12s\n", "subsystem", "bytes", "peak bytes" );
+	for ( int i=0; i<MemorySubsystems; i++ ) {
+		fprintf( stream, "%-12s %12ld %12ld\n", subsystem_name[ i ], stats.bytes[ i ], stats.peak[ i ] );
+		total += stats.bytes[ i ];
+		peak += stats.peak[ i ];
+	}
+	fprintf( stream, "%-12s %12ld %12ld\n", "total", total, peak );
+	if ( stats.heap >= 0 )
+		fprintf( stream, "%-12s %12ld\n", "heap", stats.heap );
+	fprintf( stream, "live: %ld expressions, %ld occurrences, %ld narratives, %ld stacks, %ld variables\n",
+		stats.live.expressions, stats.live.occurrences, stats.live.narratives,
+		stats.live.stacks, stats.live.variables );
+}
+
+/*---------------------------------------------------------------------------
+	compactMemory
+---------------------------------------------------------------------------*/
+long
+compactMemory( long keep )
+/*
+	gives the empty slabs of the entity, listItem and registry pools back to
+	the OS, but for keep of them per pool. Invoked by :compact and, once
+	:compact keep set the context's memory.keep, after each run of frames
+	- see systemFrames(). Entities released are unreadable thereafter.
+	Returns the number of bytes released.
+*/
+{
+	return compactEntities( keep ) + compactItems( keep ) + compactRegistry( keep );
+}
@@ -0,0 +1,16 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+/*---------------------------------------------------------------------------
+	memory utilities	- public
+---------------------------------------------------------------------------*/
+
+#define COMPACT_KEEP	-1	// empty slabs kept per pool after frames - none compacted by default
+
+void	memoryStats( MemoryStats *stats, _context *context );
+void	updateMemoryPeaks( _context *context );
+void	outputMemoryStats( FILE *stream, _context *context );
+long	compactMemory( long keep );
+
+
+#endif	// MEMORY_H
@@ -0,0 +1,371 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "database.h"
+#include "registry.h"
+
+#ifndef CONSENSUS_VERSION
+#define CONSENSUS_VERSION	"unknown"
+#endif
+
+#define RUN_NS		20000000L	// minimum time spent per measurement
+#define MAX_RUNS	1000
+
+/*---------------------------------------------------------------------------
+	consensus_microbench
+---------------------------------------------------------------------------*/
+/*
+	Measures the ns per operation of the container primitives of
+	database.c and registry.c, on containers of 10 up to 10M elements, with
+	and without warm-up - i.e. with the pools holding enough free objects
+	for the operations measured, or holding none, so that these operations
+	map new slabs.
+	Operations which traverse their container are measured over a number
+	of operations inversely proportional to its size - see ops() - so that
+	each measurement performs a bounded number of steps.
+	Each measurement is repeated until it has taken RUN_NS overall, and
+	the best and mean ns per operation are reported as JSON.
+*/
+static struct {
+	long min, max, budget;
+	char *label, *only, *output;
+	struct {
+		char *ptr;	// "k%010ld" of each key, 12 bytes apart
+		long count;
+	} names;
+	Entity **entities;
+} Micro = { 10, 10000000, 10000000, NULL, NULL, NULL, { NULL, 0 }, NULL };
+
+static long
+now( void )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/*---------------------------------------------------------------------------
+	keys
+---------------------------------------------------------------------------*/
+/*
+	containers of size n hold the even keys 0 .. 2n-2, so that the odd keys
+	designate elements not there, between these. Keys are turned into item
+	pointers or registry names, which compare in the same order.
+*/
+#define KEY_PTR( k )	((void *) (( (uintptr_t) ( k ) + 1 ) * 16 ))
+#define KEY_NAME( k )	( Micro.names.ptr + ( k ) * 12 )
+#define PRIME		7919
+
+static long
+pick( long i, long n )
+/*
+	returns the i-th of n distinct indices in [ 0, n ), in scattered order -
+	n being a power of 10, it is coprime with PRIME
+*/
+{
+	return ( i * PRIME + 13 ) % n;
+}
+
+static listItem *
+sorted_list( long n )
+{
+	listItem *list = NULL;
+	for ( long i=n-1; i>=0; i-- )
+		addItem( &list, KEY_PTR( 2 * i ) );
+	return list;
+}
+
+static void
+make_names( long n )
+/*
+	names are only generated for the name registry's benchmark, as needed
+*/
+{
+	if ( Micro.names.count >= 2 * n ) return;
+	Micro.names.ptr = (char *) realloc( Micro.names.ptr, 2 * n * 12 );
+	for ( long k=Micro.names.count; k<2*n; k++ )
+		sprintf( KEY_NAME( k ), "k%010ld", k );
+	Micro.names.count = 2 * n;
+}
+
+static Registry
+sorted_registry( long n, int by_name )
+{
+	if ( by_name ) make_names( n );
+	Registry registry = NULL;
+	for ( long i=n-1; i>=0; i-- ) {
+		registryEntry *r = by_name ?
+			newRegistryItem( KEY_NAME( 2 * i ), NULL ) :
+			newRegistryItem( KEY_PTR( 2 * i ), NULL );
+		r->next = registry;
+		registry = r;
+	}
+	return registry;
+}
+
+/*---------------------------------------------------------------------------
+	warm-up
+---------------------------------------------------------------------------*/
+typedef enum {
+	NoPool,
+	ItemPool,
+	EntityPool,
+	RegistryPool
+}
+Pool;
+
+static void
+prepare( Pool pool, long count, int warm )
+/*
+	either makes sure that pool holds count free objects, or releases all
+	its empty slabs
+*/
+{
+	switch ( pool ) {
+	case NoPool:
+		break;
+	case ItemPool:
+		if ( warm ) {
+			listItem *list = NULL;
+			for ( long i=0; i<count; i++ ) addItem( &list, NULL );
+			freeListItem( &list );
+		}
+		else compactItems( 0 );
+		break;
+	case EntityPool:
+		if ( warm ) {
+			for ( long i=0; i<count; i++ )
+				Micro.entities[ i ] = newEntity( NULL, NULL, NULL );
+			for ( long i=0; i<count; i++ )
+				freeEntity( Micro.entities[ i ] );
+		}
+		else compactEntities( 0 );
+		break;
+	case RegistryPool:
+		if ( warm ) {
+			Registry registry = NULL;
+			for ( long i=0; i<count; i++ ) {
+				registryEntry *r = newRegistryItem( NULL, NULL );
+				r->next = registry;
+				registry = r;
+			}
+			freeRegistry( &registry );
+		}
+		else compactRegistry( 0 );
+		break;
+	}
+}
+
+/*---------------------------------------------------------------------------
+	primitives
+---------------------------------------------------------------------------*/
+static long
+run_addItem( long n, long ops, int warm )
+{
+	listItem *list = NULL;
+	prepare( ItemPool, ops, warm );
+	long start = now();
+	for ( long i=0; i<ops; i++ )
+		addItem( &list, KEY_PTR( i ) );
+	long ns = now() - start;
+	freeListItem( &list );
+	return ns;
+}
+
+static long
+run_addIfNotThere( long n, long ops, int warm )
+{
+	listItem *list = sorted_list( n );
+	prepare( ItemPool, ops, warm );
+	long start = now();
+	for ( long i=0; i<ops; i++ )
+		addIfNotThere( &list, KEY_PTR( 2 * pick( i, n ) + 1 ));
+	long ns = now() - start;
+	freeListItem( &list );
+	return ns;
+}
+
+static long
+run_removeItem( long n, long ops, int warm )
+{
+	listItem *list = sorted_list( n );
+	long start = now();
+	for ( long i=0; i<ops; i++ )
+		removeItem( &list, KEY_PTR( 2 * pick( i, n )));
+	long ns = now() - start;
+	freeListItem( &list );
+	return ns;
+}
+
+static long
+run_lookupItem( long n, long ops, int warm )
+{
+	listItem *list = sorted_list( n );
+	long found = 0;
+	long start = now();
+	for ( long i=0; i<ops; i++ )
+		found += ( lookupItem( list, KEY_PTR( 2 * pick( i, n ))) != NULL );
+	long ns = now() - start;
+	if ( found != ops ) fprintf( stderr, "consensus_microbench: lookupItem: %ld missed\n", ops - found );
+	freeListItem( &list );
+	return ns;
+}
+
+static long
+run_registerByName( long n, long ops, int warm )
+{
+	Registry registry = sorted_registry( n, 1 );
+	prepare( RegistryPool, ops, warm );
+	long start = now();
+	for ( long i=0; i<ops; i++ )
+		registerByName( &registry, KEY_NAME( 2 * pick( i, n ) + 1 ), NULL );
+	long ns = now() - start;
+	freeRegistry( &registry );
+	return ns;
+}
+
+static long
+run_lookupByAddress( long n, long ops, int warm )
+{
+	Registry registry = sorted_registry( n, 0 );
+	long found = 0;
+	long start = now();
+	for ( long i=0; i<ops; i++ )
+		found += ( lookupByAddress( registry, KEY_PTR( 2 * pick( i, n ))) != NULL );
+	long ns = now() - start;
+	if ( found != ops ) fprintf( stderr, "consensus_microbench: lookupByAddress: %ld missed\n", ops - found );
+	freeRegistry( &registry );
+	return ns;
+}
+
+static long
+run_newEntity( long n, long ops, int warm )
+{
+	prepare( EntityPool, ops, warm );
+	long start = now();
+	for ( long i=0; i<ops; i++ )
+		Micro.entities[ i ] = newEntity( NULL, NULL, NULL );
+	long ns = now() - start;
+	for ( long i=0; i<ops; i++ )
+		freeEntity( Micro.entities[ i ] );
+	return ns;
+}
+
+static long
+run_freeEntity( long n, long ops, int warm )
+/*
+	without warm-up, the entities freed are the only ones in their slabs
+*/
+{
+	prepare( EntityPool, ops, warm );
+	for ( long i=0; i<ops; i++ )
+		Micro.entities[ i ] = newEntity( NULL, NULL, NULL );
+	long start = now();
+	for ( long i=0; i<ops; i++ )
+		freeEntity( Micro.entities[ i ] );
+	return now() - start;
+}
+
+typedef long _run( long n, long ops, int warm );
+
+static struct {
+	char *name;
+	_run *run;
+	int linear;	// whether each operation traverses the container
+	int allocates;	// whether warm-up makes any difference
+} Primitive[] = {
+	{ "addItem", run_addItem, 0, 1 },
+	{ "addIfNotThere", run_addIfNotThere, 1, 1 },
+	{ "removeItem", run_removeItem, 1, 0 },
+	{ "lookupItem", run_lookupItem, 1, 0 },
+	{ "registerByName", run_registerByName, 1, 1 },
+	{ "lookupByAddress", run_lookupByAddress, 1, 0 },
+	{ "newEntity", run_newEntity, 0, 1 },
+	{ "freeEntity", run_freeEntity, 0, 1 },
+	{ NULL, NULL, 0, 0 }
+};
+
+static long
+ops( long n, int linear )
+{
+	if ( !linear ) return n;
+	long ops = Micro.budget / n;
+	return ( ops < 1 ) ? 1 : ( ops > n ) ? n : ops;
+}
+
+/*---------------------------------------------------------------------------
+	main
+---------------------------------------------------------------------------*/
+static void
+usage( char *name )
+{
+	fprintf( stderr, "usage: %s [ --min size ] [ --max size ] [ --budget steps ]\n"
+		"\t[ --only primitive ] [ --label text ] [ -o file.json ]\n", name );
+	exit( EXIT_FAILURE );
+}
+
+int
+main( int argc, char ** argv )
+{
+	for ( int i=1; i<argc; i++ ) {
+		char *option = argv[ i ];
+		if ( i + 1 == argc ) usage( argv[ 0 ] );
+		char *value = argv[ ++i ];
+		if ( !strcmp( option, "--min" ) ) Micro.min = atol( value );
+		else if ( !strcmp( option, "--max" ) ) Micro.max = atol( value );
+		else if ( !strcmp( option, "--budget" ) ) Micro.budget = atol( value );
+		else if ( !strcmp( option, "--only" ) ) Micro.only = value;
+		else if ( !strcmp( option, "--label" ) ) Micro.label = value;
+		else if ( !strcmp( option, "-o" ) ) Micro.output = value;
+		else usage( argv[ 0 ] );
+	}
+	if (( Micro.min < 1 ) || ( Micro.max < Micro.min ) || ( Micro.budget < 1 ))
+		usage( argv[ 0 ] );
+
+	FILE *out = ( Micro.output == NULL ) ? stdout : fopen( Micro.output, "w" );
+	if ( out == NULL ) {
+		perror( "consensus_microbench" );
+		return EXIT_FAILURE;
+	}
+	long size = 1;
+	while ( size < Micro.min ) size *= 10;
+
+	Micro.entities = (Entity **) malloc( Micro.max * sizeof(Entity *) );
+
+	fprintf( out, "{\n\t\"version\": \"%s\",\n", CONSENSUS_VERSION );
+	fprintf( out, "\t\"label\": \"%s\",\n", ( Micro.label == NULL ) ? "" : Micro.label );
+	fprintf( out, "\t\"budget\": %ld,\n", Micro.budget );
+	fprintf( out, "\t\"results\": [" );
+	int first = 1;
+	for ( ; size<=Micro.max; size*=10 )
+	for ( int p=0; Primitive[ p ].name!=NULL; p++ ) {
+		if (( Micro.only != NULL ) && strcmp( Micro.only, Primitive[ p ].name ))
+			continue;
+		for ( int warm=0; warm<=Primitive[ p ].allocates; warm++ ) {
+			long n = ops( size, Primitive[ p ].linear );
+			long total = 0, best = -1;
+			int runs = 0;
+			while (( total < RUN_NS ) && ( runs < MAX_RUNS )) {
+				long ns = Primitive[ p ].run( size, n, warm );
+				if (( best < 0 ) || ( ns < best )) best = ns;
+				total += ns;
+				runs++;
+			}
+			fprintf( out, "%s\n\t\t{ \"primitive\": \"%s\", \"size\": %ld, \"warm\": %s, \"ops\": %ld, "
+				"\"runs\": %d, \"best_ns_per_op\": %.2f, \"mean_ns_per_op\": %.2f }",
+				first ? "" : ",", Primitive[ p ].name, size,
+				Primitive[ p ].allocates ? ( warm ? "true" : "false" ) : "null",
+				n, runs, (double) best / n, (double) total / runs / n );
+			fflush( out );
+			first = 0;
+		}
+	}
+	fprintf( out, "\n\t]\n}\n" );
+	if ( out != stdout ) fclose( out );
+	free( Micro.names.ptr );
+	free( Micro.entities );
+	return EXIT_SUCCESS;
+}
@@ -20,9 +20,23 @@
 /*---------------------------------------------------------------------------
 	registerNarrative
 ---------------------------------------------------------------------------*/
+static int
+has_release_event( Occurrence *thread )
+{
+	for ( listItem *i = thread->sub.n; i!=NULL; i=i->next ) {
+		Occurrence *occurrence = (Occurrence *) i->ptr;
+		if (( occurrence->type == EventOccurrence ) && occurrence->va.event.type.release )
+			return 1;
+		if ( has_release_event( occurrence ) )
+			return 1;
+	}
+	return 0;
+}
+
 void
 registerNarrative( Narrative *narrative, _context *context )
 {
+	narrative->release = has_release_event( &narrative->root );
 	addItem( &context->narrative.registered, narrative );
 }
 
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE	// asprintf
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "registry.h"
+#include "kernel.h"
+
+#include "api.h"
+#include "frame.h"
+#include "input.h"
+#include "expression.h"
+#include "variables.h"
+#include "native.h"
+
+// #define DEBUG
+
+/*---------------------------------------------------------------------------
+	native utilities
+---------------------------------------------------------------------------*/
+NativeVA *
+lookupNative( char *name )
+{
+	registryEntry *entry = lookupByName( CN.natives, name );
+	return ( entry == NULL ) ? NULL : (NativeVA *) entry->value;
+}
+
+static void
+free_native_args( _context *context )
+{
+	for ( listItem *i = context->native.args; i!=NULL; i=i->next ) {
+		char *name = (char *) i->ptr;
+		if (( name != this_symbol ) && ( name != variator_symbol ))
+			free( name );
+	}
+	freeListItem( &context->native.args );
+}
+
+static Entity **
+entity_array( listItem *list )
+{
+	int count = 0;
+	for ( listItem *i = list; i!=NULL; i=i->next ) count++;
+	Entity **array = (Entity **) malloc( ( count + 1 ) * sizeof(Entity *) );
+	count = 0;
+	for ( listItem *i = list; i!=NULL; i=i->next )
+		array[ count++ ] = (Entity *) i->ptr;
+	array[ count ] = NULL;
+	return array;
+}
+
+static Entity **
+variable_entities( VariableVA *variable, _context *context )
+/*
+	returns the entities currently held by variable. Expression variables are
+	evaluated, and literal variables resolved to the entities they designate,
+	if these still exist.
+*/
+{
+	listItem *results = NULL;
+	context->expression.mode = EvaluateMode;
+	context->expression.filter = NULL;
+
+	switch ( variable->type ) {
+	case EntityVariable:
+		return entity_array( (listItem *) variable->data.value );
+	case ExpressionVariable:
+		if ( expression_solve( ((listItem *) variable->data.value )->ptr, 3, context ) > 0 ) {
+			results = context->expression.results;
+			context->expression.results = NULL;
+		}
+		break;
+	case LiteralVariable:
+		for ( listItem *i = (listItem *) variable->data.value; i!=NULL; i=i->next ) {
+			ExpressionSub *s = (ExpressionSub *) i->ptr;
+			if ( expression_solve( s->e, 3, context ) > 0 ) {
+				results = catListItem( context->expression.results, results );
+				context->expression.results = NULL;
+			}
+		}
+		break;
+	case NarrativeVariable:
+		return NULL;
+	}
+	Entity **array = entity_array( results );
+	freeListItem( &results );
+	return array;
+}
+
+/*---------------------------------------------------------------------------
+	read_native_args
+---------------------------------------------------------------------------*/
+#define native_do_( a, s ) \
+	event = native_execute( a, &state, event, s, context );
+
+static int
+native_execute( _action action, char **state, int event, char *next_state, _context *context )
+{
+	event = action( *state, event, &next_state, context );
+	if ( strcmp( next_state, same ) )
+		*state = next_state;
+	return event;
+}
+
+static int
+add_this_arg( char *state, int event, char **next_state, _context *context )
+{
+	addItem( &context->native.args, this_symbol );
+	return 0;
+}
+
+static int
+add_variator_arg( char *state, int event, char **next_state, _context *context )
+{
+	addItem( &context->native.args, variator_symbol );
+	return 0;
+}
+
+static int
+add_variable_arg( char *state, int event, char **next_state, _context *context )
+{
+	if ( !context_check( 0, InstructionMode, ExecutionMode ) )
+		return event;
+
+	if ( context->identifier.id[ 0 ].type != DefaultIdentifier ) {
+		return raise_error( context, event, "variable names cannot be in \"quotes\"" );
+	}
+	addItem( &context->native.args, context->identifier.id[ 0 ].ptr );
+	context->identifier.id[ 0 ].ptr = NULL;
+	return event;
+}
+
+int
+read_native_args( char *state, int event, char **next_state, _context *context )
+/*
+	reads the argument list of a native action invocation, e.g.
+		( %%, %?, %variable )
+	where %% stands for this and %? for the variator. The variable names
+	are kept in context->native.args until command_native()
+*/
+{
+	free_native_args( context );
+	event = 0;	// we know it is '('
+	state = base;
+	do {
+	event = input( state, event, NULL, context );
+#ifdef DEBUG
+	fprintf( stderr, "debug> read_native_args: in \"%s\", on '%c'\n", state, event );
+#endif
+	bgn_
+	on_( -1 )	native_do_( nothing, "" )
+	in_( base ) bgn_
+		on_( ' ' )	native_do_( nop, same )
+		on_( '\t' )	native_do_( nop, same )
+		on_( '%' )	native_do_( nop, "%" )
+		on_( ')' )	native_do_( nop, "" )
+		on_other	native_do_( error, "" )
+		end
+		in_( "%" ) bgn_
+			on_( '%' )	native_do_( add_this_arg, "%_" )
+			on_( '?' )	native_do_( add_variator_arg, "%_" )
+			on_other	native_do_( read_identifier, "%variable" )
+			end
+			in_( "%variable" ) bgn_
+				on_any	native_do_( add_variable_arg, "%_" )
+				end
+			in_( "%_" ) bgn_
+				on_( ' ' )	native_do_( nop, same )
+				on_( '\t' )	native_do_( nop, same )
+				on_( ',' )	native_do_( nop, "%_," )
+				on_( ')' )	native_do_( nop, "" )
+				on_other	native_do_( error, "" )
+				end
+				in_( "%_," ) bgn_
+					on_( ' ' )	native_do_( nop, same )
+					on_( '\t' )	native_do_( nop, same )
+					on_( '%' )	native_do_( nop, "%" )
+					on_other	native_do_( error, "" )
+					end
+	end
+	}
+	while ( strcmp( state, "" ) );
+
+	return event;
+}
+
+/*---------------------------------------------------------------------------
+	command_native
+---------------------------------------------------------------------------*/
+int
+command_native( char *state, int event, char **next_state, _context *context )
+/*
+	invokes the native action registered under context->identifier.id[ 1 ]
+	with the entities held by each of the variables read by read_native_args
+*/
+{
+	if ( !context_check( 0, 0, ExecutionMode ) ) {
+		free_native_args( context );
+		return 0;
+	}
+	if ( serialOnly( context ) ) {
+		free_native_args( context );
+		return raise_error( context, event, NULL );
+	}
+
+	char *name = context->identifier.id[ 1 ].ptr;
+	NativeVA *native = lookupNative( name );
+	if ( native == NULL ) {
+		free_native_args( context );
+		char *msg; asprintf( &msg, "unknown native action '%s'", name );
+		event = raise_error( context, event, msg ); free( msg );
+		return event;
+	}
+
+#ifdef DEBUG
+	fprintf( stderr, "debug> command_native: %s\n", name );
+#endif
+	int argc = reorderListItem( &context->native.args );
+	Entity ***argv = (Entity ***) calloc( argc + 1, sizeof(Entity **) );
+
+	char *msg = NULL;
+	argc = 0;
+	for ( listItem *i = context->native.args; i!=NULL; i=i->next, argc++ )
+	{
+		char *arg = (char *) i->ptr;
+		registryEntry *entry = lookupVariable( context, arg );
+		if ( entry == NULL ) {
+			asprintf( &msg, "variable '%s' is not set", arg );
+			break;
+		}
+		argv[ argc ] = variable_entities( (VariableVA *) entry->value, context );
+		if ( argv[ argc ] == NULL ) {
+			asprintf( &msg, "variable '%s' cannot be passed to native action", arg );
+			break;
+		}
+	}
+	free_native_args( context );
+
+	if (( msg == NULL ) && ( native->action( argc, argv, native->user_data ) < 0 )) {
+		asprintf( &msg, "native action '%s' failed", name );
+	}
+	for ( int i=0; argv[ i ]!=NULL; i++ )
+		free( argv[ i ] );
+	free( argv );
+
+	if ( msg != NULL ) {
+		event = raise_error( context, event, msg ); free( msg );
+		return event;
+	}
+	return 0;
+}
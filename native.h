@@ -0,0 +1,18 @@
+#ifndef NATIVE_H
+#define NATIVE_H
+
+/*---------------------------------------------------------------------------
+	native actions		- public
+---------------------------------------------------------------------------*/
+
+_action	read_native_args;
+_action	command_native;
+
+/*---------------------------------------------------------------------------
+	native utilities	- public
+---------------------------------------------------------------------------*/
+
+NativeVA *lookupNative( char *name );
+
+
+#endif	// NATIVE_H
@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
 
 #include "database.h"
 #include "registry.h"
@@ -9,18 +10,52 @@
 #include "api.h"
 #include "input.h"
 #include "command.h"
+#include "expression.h"
+#include "frame.h"
 #include "output.h"
 #include "variables.h"
 
 // #define DEBUG
 
+/*---------------------------------------------------------------------------
+	outputf, setOutputStream
+---------------------------------------------------------------------------*/
+static __thread FILE *Output = NULL;	// NULL: stdout
+
+int
+outputf( const char *format, ... )
+/*
+	printf() to the calling thread's output stream - see setOutputStream()
+*/
+{
+	va_list ap;
+	va_start( ap, format );
+	int retval = vfprintf(( Output != NULL ) ? Output : stdout, format, ap );
+	va_end( ap );
+	return retval;
+}
+
+FILE *
+setOutputStream( FILE *stream )
+/*
+	sets the calling thread's output stream - stdout if stream is NULL -
+	and returns the previous one, for restoring. The threads running
+	narrative actions hold their output until it can be written in order
+	- see parallel_actions() in frame.c
+*/
+{
+	FILE *previous = Output;
+	Output = stream;
+	return previous;
+}
+
 /*---------------------------------------------------------------------------
 	prompt
 ---------------------------------------------------------------------------*/
 void
 prompt( _context *context )
 {
-	if ( !context->control.prompt )
+	if ( !context->control.prompt || context->control.quiet )
 		return;
 
 	context->control.prompt = 0;
@@ -41,12 +76,12 @@ prompt( _context *context )
 			else
 				fprintf( stderr, "in/on/do_$ " );
 		} else {
-			printf( "consensus$ " );
+			outputf( "consensus$ " );
 		}
 		break;
 	}
 	for ( int i=0; i < context->control.level; i++ )
-		printf( "\t" );
+		outputf( "\t" );
 }
 
 /*---------------------------------------------------------------------------
@@ -84,43 +119,43 @@ output_expression( ExpressionOutput component, Expression *expression, int i, in
 	switch ( component ) {
 	case SubFlags:
 		if ( sub[ i ].result.active )
-			printf( "*" );
+			outputf( "*" );
 		if ( sub[ i ].result.inactive )
-			printf( "_" );
+			outputf( "_" );
 		if ( sub[ i ].result.not )
-			printf( "~" );
+			outputf( "~" );
 		return 1;
 	case SubAny:
 		output_expression( SubFlags, expression, i, shorty );
-		printf( mark & ( 1 << i ) ? "?" : "." );
+		outputf( mark & ( 1 << i ) ? "?" : "." );
 		return 1;
 	case SubVariable:
 		if ( sub[ i ].result.identifier.value != NULL ) {
 			output_expression( SubFlags, expression, i, shorty );
-			printf( "%%%s", sub[ i ].result.identifier.value );
+			outputf( "%%%s", sub[ i ].result.identifier.value );
 		}
 		return 1;
 	case SubIdentifier:
 		if ( sub[ i ].result.identifier.value != NULL ) {
 			output_expression( SubFlags, expression, i, shorty );
-			printf( "%s", sub[ i ].result.identifier.value );
+			outputf( "%s", sub[ i ].result.identifier.value );
 		}
 		return 1;
 	case SubNull:
 		if ( shorty ) {
-			printf( "[ " );
+			outputf( "[ " );
 			if ( mark == ( 1 << i ) ) {
-				printf( "?:" );
+				outputf( "?:" );
 			}
-			printf( sub[ i ].result.not ? "~" : "~." );
-			printf( " ]" );
+			outputf( sub[ i ].result.not ? "~" : "~." );
+			outputf( " ]" );
 		}
 		return 1;
 	case SubSub:
 		output_expression( SubFlags, expression, i, shorty );
-		printf( "[ " );
+		outputf( "[ " );
 		output_expression( ExpressionAll, sub[ i ].e, -1, -1 );
-		printf( " ]" );
+		outputf( " ]" );
 		return 1;
 	case SubAll:
 		if ( sub[ i ].result.any ) {
@@ -147,7 +182,7 @@ output_expression( ExpressionOutput component, Expression *expression, int i, in
 	case ExpressionMark:
 		switch ( mark ) {
 		case 0:	return 0;
-		case 8: printf( "?" );
+		case 8: outputf( "?" );
 			return 1;
 		default: if ( !sub[ 1 ].result.none &&
 			    ((( mark == 1 ) && sub[ 0 ].result.any ) ||
@@ -159,9 +194,9 @@ output_expression( ExpressionOutput component, Expression *expression, int i, in
 		if ( mark & 8 ) {
 			printf ( "?|" );
 		}
-		printf( ( mark & 1 ) ? "?" : "." );
-		printf( ( mark & 2 ) ? "?" : "." );
-		printf( ( mark & 4 ) ? "?" : "." );
+		outputf( ( mark & 1 ) ? "?" : "." );
+		outputf( ( mark & 2 ) ? "?" : "." );
+		outputf( ( mark & 4 ) ? "?" : "." );
 		return 1;
 	case ExpressionAll:
 		break;
@@ -171,7 +206,7 @@ output_expression( ExpressionOutput component, Expression *expression, int i, in
 	// -------------------------------------------------
 
 	if ( expression == NULL ) {
-		printf( "(null)" );
+		outputf( "(null)" );
 		return 1;
 	}
 
@@ -190,14 +225,14 @@ output_expression( ExpressionOutput component, Expression *expression, int i, in
 		fprintf( stderr, "debug> output_expression: no medium...\n" );
 #endif
 		if ( sub[ 0 ].result.identifier.type == NullIdentifier ) {
-			if ( mark++ ) printf( ":" );
-			printf( sub[ 0 ].result.not ? "~" : "~." );
+			if ( mark++ ) outputf( ":" );
+			outputf( sub[ 0 ].result.not ? "~" : "~." );
 		}
 		else if ( sub[ 0 ].result.any && !sub[ 0 ].result.active && !sub[ 0 ].result.inactive ) {
-			if ( !mark ) { mark++; printf( "." ); }
+			if ( !mark ) { mark++; outputf( "." ); }
 		}
 		else {
-			if ( mark++ ) printf( ": " );
+			if ( mark++ ) outputf( ": " );
 			output_expression( SubAll, expression, 0, 0 );
 		}
 	}
@@ -205,10 +240,10 @@ output_expression( ExpressionOutput component, Expression *expression, int i, in
 #ifdef DEBUG
 		fprintf( stderr, "debug> output_expression: found shorty...\n" );
 #endif
-		if ( mark++ ) printf( ": " );
+		if ( mark++ ) outputf( ": " );
 		if ( expression->result.output_swap && !sub[ 2 ].result.any ) {
 			output_expression( SubAll, expression, 2, 1 );
-			printf( "<-.." );
+			outputf( "<-.." );
 		} else {
 			output_expression( SubAll, expression, 0, 1 );
 			output_expression( SubAll, expression, 1, 1 );
@@ -219,21 +254,21 @@ output_expression( ExpressionOutput component, Expression *expression, int i, in
 #ifdef DEBUG
 		fprintf( stderr, "debug> output_expression: output body - swap...\n" );
 #endif
-		if ( mark++ ) printf( ": " );
+		if ( mark++ ) outputf( ": " );
 		output_expression( SubAll, expression, 2, 0 );
-		printf( "<-" );
+		outputf( "<-" );
 		output_expression( SubAll, expression, 1, 0 );
-		printf( "-" );
+		outputf( "-" );
 		output_expression( SubAll, expression, 0, 0 );
 	} else {
 #ifdef DEBUG
 		fprintf( stderr, "debug> output_expression: output body...\n" );
 #endif
-		if ( mark++ ) printf( ": " );
+		if ( mark++ ) outputf( ": " );
 		output_expression( SubAll, expression, 0, 0 );
-		printf( "-" );
+		outputf( "-" );
 		output_expression( SubAll, expression, 1, 0 );
-		printf( "->" );
+		outputf( "->" );
 		output_expression( SubAll, expression, 2, 0 );
 	}
 
@@ -241,30 +276,30 @@ output_expression( ExpressionOutput component, Expression *expression, int i, in
 	if ( expression->result.as_sub ) {
 		int as_sub = expression->result.as_sub;
 		switch ( mark ) {
-		case 0: printf( ".:" ); break;
-		case 1: if ( expression->result.mark ) printf( ": . " );
-		case 2: printf( ": " ); break;
+		case 0: outputf( ".:" ); break;
+		case 1: if ( expression->result.mark ) outputf( ": . " );
+		case 2: outputf( ": " ); break;
 		}
 		if ( as_sub & 112 ) {
-			printf( "~" );
+			outputf( "~" );
 			as_sub >>= 4;
 		}
 		if ( (as_sub & 7) == 7 ) {
-			printf( "%%[ ??? ]" );
+			outputf( "%%[ ??? ]" );
 		} else {
-			printf( "%%[ " );
-			printf( as_sub & 1 ? "?" : "." );
-			printf( as_sub & 2 ? "?" : "." );
-			printf( as_sub & 4 ? "?" : "." );
-			printf( " ]" );
+			outputf( "%%[ " );
+			outputf( as_sub & 1 ? "?" : "." );
+			outputf( as_sub & 2 ? "?" : "." );
+			outputf( as_sub & 4 ? "?" : "." );
+			outputf( " ]" );
 		}
 		mark = 1;
 	}
 	else if ( sub[ 3 ].result.identifier.type == NullIdentifier ) {
-		if ( mark ) printf( ":" );
-		printf( sub[ 3 ].result.not ? "~" : "~." );
+		if ( mark ) outputf( ":" );
+		outputf( sub[ 3 ].result.not ? "~" : "~." );
 	} else if ( !sub[ 3 ].result.any || sub[ 3 ].result.active || sub[ 3 ].result.inactive ) {
-		if ( mark ) printf( ": " );
+		if ( mark ) outputf( ": " );
 		output_expression( SubAll, expression, 3, 0 );
 	}
 	return 1;
@@ -274,44 +309,44 @@ void
 output_name( Entity *e, Expression *format, int base )
 {
 	if ( e == NULL ) {
-		if ( base ) printf("(null)" );
+		if ( base ) outputf("(null)" );
 		return;
 	}
 	if ( e == CN.nil ) {
-		if ( base ) printf("(nil)" );
+		if ( base ) outputf("(nil)" );
 		return;
 	}
 	char *name = cn_name( e );
 	if ( name != NULL ) {
-		printf( "%s", name );
+		outputf( "%s", name );
 		return;
 	}
-	if ( !base ) printf( "[ " );
+	if ( !base ) outputf( "[ " );
 	if ( format == NULL )
 	{
 		output_name( e->sub[ 0 ], NULL, 0 );
-		printf( "-" );
+		outputf( "-" );
 		output_name( e->sub[ 1 ], NULL, 0 );
-		printf( "->" );
+		outputf( "->" );
 		output_name( e->sub[ 2 ], NULL, 0 );
 	}
 	else if ( format->result.output_swap )
 	{
 		output_name( e->sub[ 2 ], format->sub[ 2 ].e, 0 );
-		printf( "<-" );
+		outputf( "<-" );
 		output_name( e->sub[ 1 ], format->sub[ 1 ].e, 0 );
-		printf( "-" );
+		outputf( "-" );
 		output_name( e->sub[ 0 ], format->sub[ 0 ].e, 0 );
 	}
 	else
 	{
 		output_name( e->sub[ 0 ], format->sub[ 0 ].e, 0 );
-		printf( "-" );
+		outputf( "-" );
 		output_name( e->sub[ 1 ], format->sub[ 1 ].e, 0 );
-		printf( "->" );
+		outputf( "->" );
 		output_name( e->sub[ 2 ], format->sub[ 2 ].e, 0 );
 	}
-	if ( !base ) printf( " ]" );
+	if ( !base ) outputf( " ]" );
 }
 
 static void
@@ -324,14 +359,14 @@ output_results( listItem *i, Expression *format )
 		output_name( (Entity *) i->ptr, format, 1 );
 	}
 	else  {
-		printf( "{ " );
+		outputf( "{ " );
 		output_name( (Entity *) i->ptr, format, 1 );
 		for ( i = i->next; i!=NULL; i=i->next )
 		{
-			printf( ", " );
+			outputf( ", " );
 			output_name( (Entity *) i->ptr, format, 1 );
 		}
-		printf( " }" );
+		outputf( " }" );
 	}
 }
 
@@ -344,21 +379,21 @@ output_value( VariableVA *variable )
 		Entity *e = (Entity *) r->identifier;
 		char *narrative = (char *) r->value;
 		if ( r->next == NULL ) {
-			if ( r->identifier == CN.nil ) printf( "%s()", narrative );
-			else { printf( "%%[ " ); output_name( e, NULL, 1 ); printf( " ].%s()", narrative ); }
+			if ( r->identifier == CN.nil ) outputf( "%s()", narrative );
+			else { outputf( "%%[ " ); output_name( e, NULL, 1 ); outputf( " ].%s()", narrative ); }
 		}
 		else {
-			printf( "{ ");
-			if ( r->identifier == CN.nil ) printf( "%s()", narrative );
-			else printf( "%%[ %s ].%s()", cn_name( e ), narrative );
+			outputf( "{ ");
+			if ( r->identifier == CN.nil ) outputf( "%s()", narrative );
+			else outputf( "%%[ %s ].%s()", cn_name( e ), narrative );
 			for ( r=r->next; r!=NULL; r=r->next ) {
-				printf( ", " );
+				outputf( ", " );
 				e = (Entity *) r->identifier;
 				narrative = (char *) r->value;
-				if ( r->identifier == CN.nil ) printf( "%s()", narrative );
-				else { printf( "%%[ " ); output_name( e, NULL, 1 ); printf( " ].%s()", narrative ); }
+				if ( r->identifier == CN.nil ) outputf( "%s()", narrative );
+				else { outputf( "%%[ " ); output_name( e, NULL, 1 ); outputf( " ].%s()", narrative ); }
 			} 
-			printf( " }" );
+			outputf( " }" );
 		}
 		break;
 	case EntityVariable:
@@ -373,14 +408,14 @@ output_value( VariableVA *variable )
 		if ( i->next == NULL ) {
 			output_expression( ExpressionAll, s->e, -1, -1 );
 		} else {
-			printf( "{ " );
+			outputf( "{ " );
 			output_expression( ExpressionAll, s->e, -1, -1 );
 			for ( i=i->next; i!=NULL; i=i->next ) {
-				printf( ", " );
+				outputf( ", " );
 				ExpressionSub *s = (ExpressionSub *) i->ptr;
 				output_expression( ExpressionAll, s->e, -1, -1 );
 			} 
-			printf( " }" );
+			outputf( " }" );
 		}
 		break;
 	}
@@ -403,7 +438,7 @@ output_variable_value( char *state, int event, char **next_state, _context *cont
 	free( context->identifier.id[ 0 ].ptr );
 	context->identifier.id[ 0 ].ptr = NULL;
 
-	printf( "%c", event );
+	outputf( "%c", event );
 	return 0;
 }
 
@@ -440,7 +475,7 @@ output_expression_results( char *state, int event, char **next_state, _context *
 	context->error.flush_output = ( event != '\n' );
 	output_results( context->expression.results, context->expression.ptr );
 
-	printf( "%c", event );
+	outputf( "%c", event );
 	return 0;
 }
 
@@ -451,22 +486,22 @@ static void
 output_va_value( void *value, int narrative_account )
 {
 	if ( value == NULL ) {
-		printf( "(null)\n" );
+		outputf( "(null)\n" );
 		return;
 	}
 	if ( narrative_account ) {
 		registryEntry *i = (Registry) value;
 		if ( i->next == NULL ) {
-			printf( "%s()", (char *) i->identifier );
+			outputf( "%s()", (char *) i->identifier );
 		} else {
-			printf( "{ %s()", (char *) i->identifier );
+			outputf( "{ %s()", (char *) i->identifier );
 			for ( i = i->next; i!=NULL; i=i->next ) {
-				printf( ", %s()", (char *) i->identifier );
+				outputf( ", %s()", (char *) i->identifier );
 			}
-			printf( " }" );
+			outputf( " }" );
 		}
 	} else {
-		printf( "\"%s\"", (char *) value );
+		outputf( "\"%s\"", (char *) value );
 	}
 }
 
@@ -483,16 +518,16 @@ output_va_( char *va_name, int event, _context *context )
 	void *value = cn_va_get_value( e, va_name );
 	int narrative_account = !strcmp( va_name, "narratives" );
 
-	if ( i->next != NULL ) printf( "{ " );
+	if ( i->next != NULL ) outputf( "{ " );
 	output_va_value( value, narrative_account );
-	if ( i->next == NULL ) printf( "\n" );
+	if ( i->next == NULL ) outputf( "\n" );
 	else {
 		for ( i = i->next; i!=NULL; i=i->next ) {
 			e = (Entity *) i->ptr;
 			value = cn_va_get_value( e, va_name );
 			output_va_value( value, narrative_account );
 		}
-		printf( " }\n" );
+		outputf( " }\n" );
 	}
 }
 
@@ -513,7 +548,7 @@ output_va( char *state, int event, char **next_state, _context *context )
 	output_va_( va_name, event, context );
 
 	if ( event != '\n' ) {
-		printf( "%c", event );
+		outputf( "%c", event );
 	}
 	return 0;
 }
@@ -528,9 +563,9 @@ output_mod( char *state, int event, char **next_state, _context *context )
 		return 0;
 
 	context->error.flush_output = ( event != '\n' );
-	printf( "%%" );
+	outputf( "%%" );
 	if ( event != '\\' )
-		printf( "%c", event );
+		outputf( "%c", event );
 	return 0;
 }
 int
@@ -540,17 +575,71 @@ output_char( char *state, int event, char **next_state, _context *context )
 		return 0;
 
 	context->error.flush_output = ( event != '\n' );
-	printf( "%c", event );
+	outputf( "%c", event );
 	return 0;
 }
 
+/*---------------------------------------------------------------------------
+	output_query
+---------------------------------------------------------------------------*/
+static void
+output_query_delta( listItem *added, listItem *removed, void *user_data )
+{
+	// deltas go to the stream which was current when the query was issued
+	FILE *stream = (FILE *) user_data;
+	FILE *restore = setOutputStream( stream );
+	for ( listItem *i = added; i!=NULL; i=i->next ) {
+		outputf( "+ " );
+		output_name( (Entity *) i->ptr, NULL, 1 );
+		outputf( "\n" );
+	}
+	for ( listItem *i = removed; i!=NULL; i=i->next ) {
+		ExpressionSub *s = (ExpressionSub *) i->ptr;
+		outputf( "- " );
+		output_expression( ExpressionAll, s->e, -1, -1 );
+		outputf( "\n" );
+	}
+	fflush( stream );
+	setOutputStream( restore );
+}
+
+int
+output_query( char *state, int event, char **next_state, _context *context )
+{
+	if ( !context_check( 0, 0, ExecutionMode ) )
+		return 0;
+	if ( serialOnly( context ) )
+		return raise_error( context, event, NULL );
+
+	Expression *expression = context->expression.ptr;
+	context->expression.ptr = NULL;
+	if ( cn_watch( expression, output_query_delta, stdout ) == NULL ) {
+		freeExpression( expression );
+	}
+	return 0;
+}
+
+void
+freeOutputQueries( FILE *stream )
+{
+	listItem *next_i;
+	for ( listItem *i = CN.context->frame.queries; i!=NULL; i=next_i ) {
+		next_i = i->next;
+		StandingQuery *query = (StandingQuery *) i->ptr;
+		if (( query->callback == output_query_delta ) && ( query->user_data == stream )) {
+			freeExpression( query->expression );
+			cn_unwatch( query );
+		}
+	}
+}
+
 /*---------------------------------------------------------------------------
 	output_narrative
 ---------------------------------------------------------------------------*/
 static void
 printtab( int level )
 {
-	for ( int i=0; i < level; i++ ) printf( "\t" );
+	for ( int i=0; i < level; i++ ) outputf( "\t" );
 }
 
 static void
@@ -563,36 +652,36 @@ narrative_output_occurrence( Occurrence *occurrence, int level )
 	case EventOccurrence:
 		if ( occurrence->va.event.identifier.name != NULL ) {
 			if ( occurrence->va.event.identifier.type == VariableIdentifier )
-				printf( "%%" );
-			printf( "%s: ", occurrence->va.event.identifier.name );
+				outputf( "%%" );
+			outputf( "%s: ", occurrence->va.event.identifier.name );
 		} else if ( occurrence->va.event.type.notification ) {
-			printf( ":" );
+			outputf( ":" );
 		}
 		if ( occurrence->va.event.type.request ) {
 			if ( occurrence->va.event.type.instantiate ) {
-				printf( "!! " );
+				outputf( "!! " );
 			} else if ( occurrence->va.event.type.release ) {
-				printf( "!~ " );
+				outputf( "!~ " );
 			} else if ( occurrence->va.event.type.activate ) {
-				printf( "!* " );
+				outputf( "!* " );
 			} else if ( occurrence->va.event.type.deactivate ) {
-				printf( "!_ " );
+				outputf( "!_ " );
 			}
 		} else if ( occurrence->va.event.type.init ) {
-			printf( "init" );
+			outputf( "init" );
 		}
 		if ( occurrence->va.event.expression != NULL ) {
 			output_expression( ExpressionAll, occurrence->va.event.expression, -1, -1 );
 		}
 		if ( occurrence->va.event.type.notification ) {
 			if ( occurrence->va.event.type.instantiate ) {
-				printf( " !!" );
+				outputf( " !!" );
 			} else if ( occurrence->va.event.type.release ) {
-				printf( " !~" );
+				outputf( " !~" );
 			} else if ( occurrence->va.event.type.activate ) {
-				printf( " !*" );
+				outputf( " !*" );
 			} else if ( occurrence->va.event.type.deactivate ) {
-				printf( " !_" );
+				outputf( " !_" );
 			}
 		}
 		break;
@@ -600,8 +689,8 @@ narrative_output_occurrence( Occurrence *occurrence, int level )
 		; listItem *instruction = occurrence->va.action.instructions;
 		if ( instruction->next == NULL )
 		{
-			printf( "do " );
-			_context *context = CN.context;
+			outputf( "do " );
+			_context *context = currentContext();
 			context->control.mode = InstructionMode;
 			context->narrative.mode.action.one = 1;
 
@@ -614,8 +703,8 @@ narrative_output_occurrence( Occurrence *occurrence, int level )
 		}
 		else
 		{
-			printf( "do\n" );
-			_context *context = CN.context;
+			outputf( "do\n" );
+			_context *context = currentContext();
 			char *state = base;
 			int backup = context->control.level;
 
@@ -638,7 +727,7 @@ narrative_output_occurrence( Occurrence *occurrence, int level )
 		}
 		break;
 	case ThenOccurrence:
-		printf( "then" );
+		outputf( "then" );
 		break;
 	}
 }
@@ -648,10 +737,10 @@ narrative_output_standalone( Occurrence *occurrence, int level )
 {
 	switch ( occurrence->type ) {
 	case ConditionOccurrence:
-		printf( "in " );
+		outputf( "in " );
 		break;
 	case EventOccurrence:
-		printf( "on " );
+		outputf( "on " );
 		break;
 	case ActionOccurrence:
 	case ThenOccurrence:
@@ -665,19 +754,19 @@ narrative_output_vector( Occurrence *occurrence, int level )
 {
 	OccurrenceType type = occurrence->type;
 	if ( type == ConditionOccurrence )
-		printf( "in ( " );
+		outputf( "in ( " );
 	else
-		printf( "on ( " );
+		outputf( "on ( " );
 
 	narrative_output_occurrence( occurrence, level );
 	do {
 		occurrence = occurrence->sub.n->ptr;
 		if ( occurrence->type == type ) {
-			printf( ", " ); narrative_output_occurrence( occurrence, level );
+			outputf( ", " ); narrative_output_occurrence( occurrence, level );
 		}
 	}
 	while (( occurrence->type == type ) && ( occurrence->sub.num == 1 ));
-	printf( " )" );
+	outputf( " )" );
 
 	return occurrence;
 }
@@ -699,7 +788,7 @@ narrative_output_traverse( Occurrence *root, int level )
 			if ( occurrence->sub.num == 0 ) {
 				narrative_output_standalone( occurrence, level );
 				if (( type != ActionOccurrence ) || ( occurrence->va.action.instructions->next == NULL )) {
-					printf( "\n" );
+					outputf( "\n" );
 				}
 				occurrence = NULL;
 			}
@@ -707,7 +796,7 @@ narrative_output_traverse( Occurrence *root, int level )
 				if ( type == ActionOccurrence ) {
 					fprintf( stderr, "consensus> Error: Action can only be followed by then\n" );
 				}
-				narrative_output_standalone( occurrence, level ); printf( "\n" );
+				narrative_output_standalone( occurrence, level ); outputf( "\n" );
 				narrative_output_traverse( occurrence, level + 1 );
 				occurrence = NULL;
 			}
@@ -720,36 +809,36 @@ narrative_output_traverse( Occurrence *root, int level )
 						narrative_output_traverse( occurrence, level + 1 );
 						occurrence = NULL;
 					} else {
-						printf( " " );
+						outputf( " " );
 						occurrence = sub;
 					}
 					break;
 				case ThenOccurrence:
-					narrative_output_standalone( occurrence, level ); printf( " " );
+					narrative_output_standalone( occurrence, level ); outputf( " " );
 					occurrence = sub;
 					break;
 				case ConditionOccurrence:
 				case EventOccurrence:
 					if ( sub->type != type ) {
-						narrative_output_standalone( occurrence, level ); printf( " " );
+						narrative_output_standalone( occurrence, level ); outputf( " " );
 						occurrence = sub;
 						break;
 					}
 					occurrence = narrative_output_vector( occurrence, level );
 					if ( occurrence->type != type ) {
-						printf( " " );
+						outputf( " " );
 					}
 					else if ( occurrence->sub.num == 0 ) {
-						printf( "\n" );
+						outputf( "\n" );
 						occurrence = NULL;
 					}
 					else if ( occurrence->sub.num > 1 ) {
-						printf( "\n" );
+						outputf( "\n" );
 						narrative_output_traverse( occurrence, level + 1 );
 						occurrence = NULL;
 					}
 					else {
-						printf( " " );
+						outputf( " " );
 					}
 					break;
 				}
@@ -759,7 +848,7 @@ narrative_output_traverse( Occurrence *root, int level )
 	}
 	if ( do_close ) {
 		printtab( level );
-		printf( "/\n" );
+		outputf( "/\n" );
 	}
 }
 
@@ -774,9 +863,9 @@ narrative_output( Narrative *narrative, _context *context )
 	}
 
 	context->narrative.mode.output = 1;
-	if ( context->input.stack == NULL ) printf( "\n" );
+	if ( context->input.stack == NULL ) outputf( "\n" );
 	narrative_output_traverse( &narrative->root, 1 );
-	if ( context->input.stack == NULL ) printf( "\n" );
+	if ( context->input.stack == NULL ) outputf( "\n" );
 	context->narrative.mode.output = 0;
 
 	if ( context->input.stack == NULL )
@@ -26,15 +26,19 @@ _action output_va;
 _action output_hcn;
 _action output_mod;
 _action output_char;
+_action output_query;
 
 /*---------------------------------------------------------------------------
 	output utilities	- public
 ---------------------------------------------------------------------------*/
 
+int	outputf( const char *format, ... );
+FILE	*setOutputStream( FILE *stream );
 void	output_name( Entity *e, Expression *format, int base );
 int	output_expression( ExpressionOutput component, Expression *expression, int i, int shorty );
 void	prompt( _context *context );
 void	narrative_output( Narrative *narrative, _context *context );
+void	freeOutputQueries( FILE *stream );
 
 
 
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+// #define DEBUG
+
+#define MAX_WORKERS	64
+
+/*---------------------------------------------------------------------------
+	worker pool
+---------------------------------------------------------------------------*/
+static struct {
+	int workers;	// -1: not initialized yet
+	pthread_mutex_t lock;
+	pthread_cond_t go, done;
+	unsigned int generation;
+	_task *task;
+	void *data;
+	int count, next, finished;
+} Pool = { -1, PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER };
+
+static __thread int in_task = 0;
+
+static void
+run_tasks( void )
+/*
+	claims and runs the current job's tasks until there are none left.
+	Called with Pool.lock held, and returns with it held.
+*/
+{
+	while ( Pool.next < Pool.count ) {
+		int index = Pool.next++;
+		pthread_mutex_unlock( &Pool.lock );
+		in_task = 1;
+		Pool.task( Pool.data, index );
+		in_task = 0;
+		pthread_mutex_lock( &Pool.lock );
+		if ( ++Pool.finished == Pool.count )
+			pthread_cond_signal( &Pool.done );
+	}
+}
+
+static void *
+worker( void *arg )
+{
+	unsigned int generation = 0;
+	pthread_mutex_lock( &Pool.lock );
+	for ( ; ; ) {
+		while ( Pool.generation == generation )
+			pthread_cond_wait( &Pool.go, &Pool.lock );
+		generation = Pool.generation;
+		run_tasks();
+	}
+	return NULL;
+}
+
+/*---------------------------------------------------------------------------
+	parallel_workers
+---------------------------------------------------------------------------*/
+int
+parallel_workers( void )
+/*
+	returns the number of pool threads, which are started upon first call.
+	The pool size defaults to the number of online processors minus one -
+	the calling thread does its share - and may be set with the environment
+	variable CONSENSUS_THREADS, where 1 disables the pool altogether.
+*/
+{
+	if ( Pool.workers >= 0 )
+		return Pool.workers;
+
+	long threads = sysconf( _SC_NPROCESSORS_ONLN );
+	char *env = getenv( "CONSENSUS_THREADS" );
+	if ( env != NULL ) threads = atoi( env );
+	Pool.workers = ( threads > MAX_WORKERS ) ? MAX_WORKERS - 1 : ( threads > 1 ) ? threads - 1 : 0;
+
+	for ( int i=0; i<Pool.workers; i++ ) {
+		pthread_t thread;
+		if ( pthread_create( &thread, NULL, worker, NULL ) ) {
+			Pool.workers = i;
+			break;
+		}
+		pthread_detach( thread );
+	}
+#ifdef DEBUG
+	fprintf( stderr, "debug> parallel_workers: %d\n", Pool.workers );
+#endif
+	return Pool.workers;
+}
+
+/*---------------------------------------------------------------------------
+	parallel_for
+---------------------------------------------------------------------------*/
+void
+parallel_for( int count, _task *task, void *data )
+/*
+	invokes task( data, index ) for each index in [ 0, count ) across the
+	worker pool, and returns once all of them have completed. Tasks may
+	allocate listItems - whose free list is per thread - but not entities.
+	Nested invocations, i.e. from within a task, run inline - in the task's
+	thread, whichever way the task itself was run.
+*/
+{
+	if (( count <= 1 ) || in_task || ( parallel_workers() == 0 )) {
+		int restore = in_task;
+		in_task = 1;
+		for ( int i=0; i<count; i++ )
+			task( data, i );
+		in_task = restore;
+		return;
+	}
+	pthread_mutex_lock( &Pool.lock );
+	Pool.task = task;
+	Pool.data = data;
+	Pool.count = count;
+	Pool.next = 0;
+	Pool.finished = 0;
+	Pool.generation++;
+	pthread_cond_broadcast( &Pool.go );
+	run_tasks();
+	while ( Pool.finished < Pool.count )
+		pthread_cond_wait( &Pool.done, &Pool.lock );
+	Pool.count = 0;
+	pthread_mutex_unlock( &Pool.lock );
+}
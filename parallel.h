@@ -0,0 +1,14 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+/*---------------------------------------------------------------------------
+	parallel utilities	- public
+---------------------------------------------------------------------------*/
+
+typedef void _task( void *data, int index );
+
+int	parallel_workers( void );
+void	parallel_for( int count, _task *task, void *data );
+
+
+#endif	// PARALLEL_H
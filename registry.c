@@ -1,11 +1,21 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #include "database.h"
 #include "registry.h"
+#include "slab.h"
 
-static registryEntry *freeRegistryItemList = NULL;
+/*
+	registry entries are allocated by the threads running narrative
+	actions - for their variables - hence the lock
+*/
+static struct {
+	pthread_mutex_t lock;
+	SlabPool slabs;
+} RegistryPool = { PTHREAD_MUTEX_INITIALIZER, SLAB_POOL( registryEntry ) };
 
 /*---------------------------------------------------------------------------
 	lookupByName
@@ -191,15 +201,10 @@ deregisterByValue( Registry *registry, void *value )
 registryEntry *
 newRegistryItem( void *identifier, void *value )
 {
-        registryEntry *r;
-        if ( freeRegistryItemList == NULL )
-                r = calloc( 1, sizeof( registryEntry ) );
-        else
-        {
-                r = freeRegistryItemList;
-                freeRegistryItemList = r->next;
-		r->next = NULL;
-        }
+	pthread_mutex_lock( &RegistryPool.lock );
+        registryEntry *r = slabAlloc( &RegistryPool.slabs );
+	pthread_mutex_unlock( &RegistryPool.lock );
+	r->next = NULL;
         r->identifier = identifier;
         r->value = value;
         return r;
@@ -210,10 +215,36 @@ newRegistryItem( void *identifier, void *value )
 ---------------------------------------------------------------------------*/
 void freeRegistryItem( registryEntry *r )
 {
-	r->value = NULL;
-	r->identifier = NULL;
-        r->next = freeRegistryItemList;
-        freeRegistryItemList = r;
+	pthread_mutex_lock( &RegistryPool.lock );
+	slabFree( &RegistryPool.slabs, r );
+	pthread_mutex_unlock( &RegistryPool.lock );
+}
+
+/*---------------------------------------------------------------------------
+	registryPoolStats
+---------------------------------------------------------------------------*/
+void
+registryPoolStats( PoolStats *stats )
+{
+	pthread_mutex_lock( &RegistryPool.lock );
+	slabStats( &RegistryPool.slabs, stats );
+	pthread_mutex_unlock( &RegistryPool.lock );
+}
+
+/*---------------------------------------------------------------------------
+	compactRegistry
+---------------------------------------------------------------------------*/
+long
+compactRegistry( long keep )
+/*
+	releases the registry entries' empty slabs, but for keep of them.
+	Returns the number of bytes released.
+*/
+{
+	pthread_mutex_lock( &RegistryPool.lock );
+	long released = slabCompact( &RegistryPool.slabs, keep );
+	pthread_mutex_unlock( &RegistryPool.lock );
+	return released;
 }
 
 
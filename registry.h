@@ -11,6 +11,14 @@ registryEntry;
 
 typedef registryEntry * Registry;
 
+typedef struct {
+	long live, free;	// objects in use, and available in the pool's slabs
+	long peak;		// highest number of objects in use
+	long size;		// bytes per object
+	long slabs, empty;	// slabs mapped, and how many of these are empty
+}
+PoolStats;
+
 registryEntry *newRegistryItem( void *identifier, void *value );
 registryEntry *registerByName( Registry *registry, char *name, void *address );
 registryEntry *registerByAddress( Registry *registry, void *address, void *value );
@@ -24,5 +32,7 @@ void	deregisterByValue( Registry *registry, void *ptr );
 void	deregisterByAddress( Registry *registry, void *ptr );
 void	freeRegistryItem( registryEntry *r );
 void	freeRegistry( Registry *r );
+void	registryPoolStats( PoolStats *stats );
+long	compactRegistry( long keep );
 
 #endif	// REGISTRY_H
@@ -0,0 +1,609 @@
+#define _GNU_SOURCE	// fopencookie
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "database.h"
+#include "registry.h"
+#include "kernel.h"
+
+#include "replay.h"
+#include "frame.h"
+
+// #define DEBUG
+
+#define REPLAY_HEADER	"consensus replay 1\n"
+#define FNV_OFFSET	0xcbf29ce484222325UL
+#define FNV_PRIME	0x100000001b3UL
+
+/*---------------------------------------------------------------------------
+	replay
+---------------------------------------------------------------------------*/
+/*
+	A session is recorded as all the input it took from outside: stdin, the
+	output of the :<%( "command" ) pipes and the contents of the HCN and
+	script files, in the order in which it was consumed. The replay file holds, after
+	REPLAY_HEADER, one block per such input, each a header line followed by
+	length bytes:
+		< length		stdin
+		| length command	pipe output - length -1 if popen failed
+		@ length path		HCN file contents - -1 if fopen failed
+		$ length path		script file contents - likewise
+	and, last, the length and FNV-1a hash of everything written to stdout:
+		= length hash
+	stdin is recorded one line per block. Pipes and files are read
+	whole when opened, and then served from a copy - both when recording
+	and replaying - see replayStream(). A pipe's command therefore runs to
+	completion before its output is read. Replaying feeds the same input at
+	full speed and checks that the output is the same; in timing mode the
+	output is only hashed, and each non-blank line of stdin is timed from
+	the moment it is read to the moment the next one is requested.
+*/
+typedef enum {
+	NoReplay,
+	Recording,
+	Replaying
+}
+ReplayMode;
+
+typedef struct {
+	char *ptr;
+	long length, size;
+}
+Region;			// mapped outside the heap - see region_append()
+
+static struct {
+	ReplayMode mode;
+	FILE *record;
+	struct {
+		char ptr[ BUFSIZ ];
+		long length;
+	} line;			// stdin read since the last block - when recording
+	struct {
+		Region region;
+		char *position;
+	} file;			// replay file - when replaying
+	struct {
+		char *ptr;
+		long remaining;
+	} block;		// current stdin block - when replaying
+	struct {
+		FILE *stream;	// original stdout
+		unsigned long hash;
+		long bytes;
+		int echo;
+	} output;
+	struct {
+		int on, newline, blank;
+		long start, line;
+		Region latency;	// { long }
+	} timing;
+	int diverged;
+} Replay;
+
+static long
+now( void )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+/*---------------------------------------------------------------------------
+	regions and memory streams
+---------------------------------------------------------------------------*/
+/*
+	The engine's output may depend on the addresses which malloc() returns,
+	e.g. when listing entities. All the data recorded or replayed are
+	therefore held in mapped regions, and served through the same memory
+	streams when recording and replaying, so that both leave the heap in
+	the same state.
+*/
+static int
+region_append( Region *region, void *bytes, long n )
+{
+	if ( region->length + n > region->size ) {
+		long size = region->size ? region->size : 65536;
+		while ( size < region->length + n ) size *= 2;
+		void *ptr = ( region->ptr == NULL ) ?
+			mmap( NULL, size, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 ) :
+			mremap( region->ptr, region->size, size, MREMAP_MAYMOVE );
+		if ( ptr == MAP_FAILED )
+			return -1;
+		region->ptr = ptr;
+		region->size = size;
+	}
+	memcpy( region->ptr + region->length, bytes, n );
+	region->length += n;
+	return 0;
+}
+
+static void
+region_free( Region *region )
+{
+	if ( region->ptr != NULL )
+		munmap( region->ptr, region->size );
+	memset( region, 0, sizeof(Region) );
+}
+
+typedef struct {
+	Region region;
+	long position;
+	int owned;	// whether the region is unmapped upon closing
+}
+MemoryStream;
+
+static ssize_t
+stream_read( void *cookie, char *buffer, size_t size )
+{
+	MemoryStream *stream = cookie;
+	long n = stream->region.length - stream->position;
+	if ( n > size ) n = size;
+	memcpy( buffer, stream->region.ptr + stream->position, n );
+	stream->position += n;
+	return n;
+}
+
+static int
+stream_close( void *cookie )
+{
+	MemoryStream *stream = cookie;
+	if ( stream->owned ) region_free( &stream->region );
+	free( stream );
+	return 0;
+}
+
+static FILE *
+memory_stream( Region *region, int owned )
+{
+	MemoryStream *stream = (MemoryStream *) calloc( 1, sizeof(MemoryStream) );
+	stream->region = *region;
+	stream->owned = owned;
+	cookie_io_functions_t io = { stream_read, NULL, NULL, stream_close };
+	FILE *file = fopencookie( stream, "r", io );
+	if ( file == NULL ) stream_close( stream );
+	return file;
+}
+
+/*---------------------------------------------------------------------------
+	output hashing
+---------------------------------------------------------------------------*/
+static ssize_t
+output_write( void *cookie, const char *buffer, size_t size )
+{
+	for ( size_t i=0; i<size; i++ ) {
+		Replay.output.hash ^= (unsigned char) buffer[ i ];
+		Replay.output.hash *= FNV_PRIME;
+	}
+	Replay.output.bytes += size;
+	if ( Replay.output.echo ) {
+		fwrite( buffer, 1, size, Replay.output.stream );
+		fflush( Replay.output.stream );
+	}
+	return size;
+}
+
+static int
+hash_output( int echo )
+/*
+	replaces stdout with a stream which hashes everything written to it,
+	and passes it on to the original stdout if echo is set
+*/
+{
+	cookie_io_functions_t io = { NULL, output_write, NULL, NULL };
+	FILE *stream = fopencookie( NULL, "w", io );
+	if ( stream == NULL )
+		return -1;
+	setvbuf( stream, NULL, echo ? _IOLBF : _IOFBF, BUFSIZ );
+	Replay.output.stream = stdout;
+	Replay.output.hash = FNV_OFFSET;
+	Replay.output.echo = echo;
+	stdout = stream;
+	return 0;
+}
+
+/*---------------------------------------------------------------------------
+	replayRecord
+---------------------------------------------------------------------------*/
+int
+replayRecord( char *path )
+/*
+	starts recording the session into the file at path - returns -1 if the
+	file could not be opened
+*/
+{
+	if ( Replay.mode != NoReplay )
+		return -1;
+	Replay.record = fopen( path, "w" );
+	if ( Replay.record == NULL )
+		return -1;
+	if ( hash_output( 1 ) < 0 ) {
+		fclose( Replay.record );
+		return -1;
+	}
+	fprintf( Replay.record, REPLAY_HEADER );
+	Replay.mode = Recording;
+	return 0;
+}
+
+static void
+record_line( void )
+{
+	if ( Replay.line.length == 0 )
+		return;
+	fprintf( Replay.record, "< %ld\n", Replay.line.length );
+	fwrite( Replay.line.ptr, 1, Replay.line.length, Replay.record );
+	fflush( Replay.record );
+	Replay.line.length = 0;
+}
+
+static void
+record_char( int event )
+{
+	Replay.line.ptr[ Replay.line.length++ ] = event;
+	if (( event == '\n' ) || ( Replay.line.length == sizeof(Replay.line.ptr) ))
+		record_line();
+}
+
+static int
+stream_kind( InputType type )
+{
+	return	( type == PipeInput ) ? '|' :
+		( type == HCNFileInput ) ? '@' : '$';
+}
+
+static int
+read_source( char *identifier, InputType type, Region *region )
+/*
+	reads the whole of the command's output, or of the file, into region,
+	the way popen() and fopen() would - returns -1 if it could not be run
+	or opened
+*/
+{
+	int fd[ 2 ];
+	pid_t pid = 0;
+	if ( type == PipeInput ) {
+		if ( pipe( fd ) < 0 )
+			return -1;
+		pid = fork();
+		if ( pid == 0 ) {
+			close( fd[ 0 ] );
+			dup2( fd[ 1 ], STDOUT_FILENO );
+			close( fd[ 1 ] );
+			execl( "/bin/sh", "sh", "-c", identifier, (char *) NULL );
+			_exit( 127 );
+		}
+		close( fd[ 1 ] );
+		if ( pid < 0 ) {
+			close( fd[ 0 ] );
+			return -1;
+		}
+	}
+	else if (( fd[ 0 ] = open( identifier, O_RDONLY )) < 0 )
+		return -1;
+
+	char buffer[ BUFSIZ ];
+	int retval = 0;
+	for ( ssize_t n; ( n = read( fd[ 0 ], buffer, sizeof(buffer) )) != 0; )
+		if (( n < 0 ) ? ( errno != EINTR ) : ( region_append( region, buffer, n ) < 0 )) {
+			retval = -1;
+			break;
+		}
+	close( fd[ 0 ] );
+	if ( pid > 0 ) waitpid( pid, NULL, 0 );
+	return retval;
+}
+
+static FILE *
+record_stream( char *identifier, InputType type )
+/*
+	reads the whole stream into the record, and returns a copy of it
+*/
+{
+	int kind = stream_kind( type );
+	Region region = { NULL, 0, 0 };
+	record_line();
+	if ( read_source( identifier, type, &region ) < 0 ) {
+		region_free( &region );
+		fprintf( Replay.record, "%c -1 %s\n", kind, identifier );
+		return NULL;
+	}
+	fprintf( Replay.record, "%c %ld %s\n", kind, region.length, identifier );
+	fwrite( region.ptr, 1, region.length, Replay.record );
+	fflush( Replay.record );
+	return memory_stream( &region, 1 );
+}
+
+/*---------------------------------------------------------------------------
+	replayOpen
+---------------------------------------------------------------------------*/
+int
+replayOpen( char *path, int timing )
+/*
+	loads the replay file at path, which then replaces stdin. In timing
+	mode, the output is not shown, and the timings are reported upon
+	replayEnd(). Returns -1, after reporting the error, if the file could
+	not be loaded.
+*/
+{
+	if ( Replay.mode != NoReplay ) {
+		fprintf( stderr, "consensus> Error: %s: cannot replay while recording\n", path );
+		return -1;
+	}
+	int fd = open( path, O_RDONLY );
+	if ( fd < 0 ) {
+		fprintf( stderr, "consensus> Error: %s: %s\n", path, strerror( errno ));
+		return -1;
+	}
+	Region *region = &Replay.file.region;
+	char buffer[ BUFSIZ ];
+	int loaded = 1;
+	for ( ssize_t n; ( n = read( fd, buffer, sizeof(buffer) )) != 0; )
+		if (( n < 0 ) ? ( errno != EINTR ) : ( region_append( region, buffer, n ) < 0 )) {
+			loaded = 0;
+			break;
+		}
+	close( fd );
+	long header = strlen( REPLAY_HEADER );
+	if ( !loaded || ( region->length < header ) || strncmp( region->ptr, REPLAY_HEADER, header ) ||
+	     ( region_append( region, "", 1 ) < 0 ) ||	// for sscanf()
+	     ( hash_output( !timing ) < 0 )) {
+		fprintf( stderr, "consensus> Error: %s: not a replay file\n", path );
+		region_free( region );
+		return -1;
+	}
+	region->length--;
+	Replay.file.position = region->ptr + header;
+	Replay.timing.on = timing;
+	Replay.timing.newline = 1;
+	Replay.timing.blank = 1;
+	Replay.timing.start = now();
+	Replay.mode = Replaying;
+	return 0;
+}
+
+static int
+next_block( long *length, char **identifier, int *id_length, char **bytes )
+/*
+	returns the kind of the block at the current position, and moves past
+	it - or returns 0 if there are no more, or the file is malformed
+*/
+{
+	char *position = Replay.file.position;
+	char *limit = Replay.file.region.ptr + Replay.file.region.length;
+	char *eol = ( position < limit ) ? memchr( position, '\n', limit - position ) : NULL;
+	if ( eol == NULL )
+		return 0;
+	char kind; int n = 0;
+	if (( sscanf( position, "%c %ld%n", &kind, length, &n ) < 2 ) || ( position + n > eol ))
+		return 0;
+	*identifier = position + n + ( position[ n ] == ' ' );
+	*id_length = eol - *identifier;
+	*bytes = eol + 1;
+	long skip = (( kind != '=' ) && ( *length > 0 )) ? *length : 0;
+	if ( skip > limit - *bytes )
+		return 0;
+	Replay.file.position = *bytes + skip;
+	return kind;
+}
+
+static void
+diverge( char *message )
+{
+	if ( !Replay.diverged )
+		fprintf( stderr, "consensus> Warning: replay diverged from the recording: %s\n", message );
+	Replay.diverged = 1;
+}
+
+static void
+time_line( void )
+/*
+	closes the current line's timing if the line before was complete
+*/
+{
+	long t = now();
+	if ( Replay.timing.newline ) {
+		if ( !Replay.timing.blank ) {
+			long latency = t - Replay.timing.line;
+			region_append( &Replay.timing.latency, &latency, sizeof(long) );
+		}
+		Replay.timing.line = t;
+		Replay.timing.newline = 0;
+		Replay.timing.blank = 1;
+	}
+}
+
+static FILE *
+replay_stream( char *identifier, InputType type )
+{
+	int expected = stream_kind( type );
+	if ( Replay.diverged )
+		return NULL;
+	if ( Replay.block.remaining > 0 ) {
+		diverge( "stream opened before the end of the line" );
+		return NULL;
+	}
+	long length; char *name, *bytes; int n;
+	int kind = next_block( &length, &name, &n, &bytes );
+	if (( kind != expected ) || ( n != strlen( identifier )) || strncmp( name, identifier, n )) {
+		diverge( identifier );
+		return NULL;
+	}
+	if ( length < 0 )
+		return NULL;
+	Region region = { bytes, length, 0 };
+	return memory_stream( &region, 0 );
+}
+
+/*---------------------------------------------------------------------------
+	replayGetchar, replayStream
+---------------------------------------------------------------------------*/
+int
+replayGetchar( void )
+/*
+	replaces getchar() for reading stdin
+*/
+{
+	int event;
+	switch ( Replay.mode ) {
+	case NoReplay:
+		return getchar();
+	case Recording:
+		event = getchar();
+		if ( event != EOF ) record_char( event );
+		return event;
+	case Replaying:
+		break;
+	}
+	if ( Replay.timing.on ) time_line();
+	while ( Replay.block.remaining == 0 ) {
+		char *position = Replay.file.position;
+		long length; char *identifier, *bytes; int n;
+		int kind = Replay.diverged ? 0 : next_block( &length, &identifier, &n, &bytes );
+		if ( kind != '<' ) {
+			// left for replayEnd()
+			Replay.file.position = position;
+			Replay.timing.newline = 1;
+			return EOF;
+		}
+		Replay.block.ptr = bytes;
+		Replay.block.remaining = length;
+	}
+	Replay.block.remaining--;
+	event = (unsigned char) *Replay.block.ptr++;
+	if ( event == '\n' )
+		Replay.timing.newline = 1;
+	else if ( !isspace( event ) )
+		Replay.timing.blank = 0;
+	return event;
+}
+
+int
+replayStream( char *identifier, InputType type, FILE **file )
+/*
+	opens the PipeInput, HCNFileInput or FileInput stream identifier when
+	recording or replaying - the stream returned must then be closed with
+	fclose(). Returns 0 otherwise, the caller opening the stream itself.
+*/
+{
+	switch ( Replay.mode ) {
+	case NoReplay:
+		return 0;
+	case Recording:
+		*file = record_stream( identifier, type );
+		break;
+	case Replaying:
+		*file = replay_stream( identifier, type );
+		break;
+	}
+#ifdef DEBUG
+	fprintf( stderr, "debug> replayStream: \"%s\": %s\n", identifier, ( *file != NULL ) ? "open" : "failed" );
+#endif
+	return 1;
+}
+
+/*---------------------------------------------------------------------------
+	replayEnd
+---------------------------------------------------------------------------*/
+static int
+compare_long( const void *a, const void *b )
+{
+	long x = *(long *) a, y = *(long *) b;
+	return ( x > y ) - ( x < y );
+}
+
+static double
+percentile( long *latency, long count, double p )
+/*
+	latency being sorted - returns the p-th percentile in ms
+*/
+{
+	long rank = (long) ( p / 100 * count + 0.999999 );
+	if ( rank < 1 ) rank = 1;
+	return latency[ rank - 1 ] / 1e6;
+}
+
+static void
+output_timing( long elapsed )
+{
+	double seconds = elapsed / 1e9;
+	unsigned long frames = frameCount();
+	long *latency = (long *) Replay.timing.latency.ptr;
+	long count = Replay.timing.latency.length / sizeof(long);
+	char *header = "%-16s %10s %10s %10s %10s %10s %10s %10s\n";
+	fprintf( stderr, header, "latency (ms)", "commands", "mean", "p50", "p90", "p99", "p99.9", "max" );
+	if ( count == 0 )
+		fprintf( stderr, "%-16s %10d\n", "command", 0 );
+	else {
+		double sum = 0;
+		for ( long i=0; i<count; i++ ) sum += latency[ i ];
+		qsort( latency, count, sizeof(long), compare_long );
+		fprintf( stderr, "%-16s %10ld %10.3f %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+			"command", count, sum / count / 1e6,
+			percentile( latency, count, 50 ), percentile( latency, count, 90 ),
+			percentile( latency, count, 99 ), percentile( latency, count, 99.9 ),
+			latency[ count - 1 ] / 1e6 );
+	}
+	fprintf( stderr, "replay: %ld commands, %lu frames in %.3f s - %.1f commands/s, %.1f frames/s\n",
+		count, frames, seconds,
+		( seconds > 0 ) ? count / seconds : 0, ( seconds > 0 ) ? frames / seconds : 0 );
+}
+
+int
+replayEnd( void )
+/*
+	called at the end of stdin: completes the record, or checks the output
+	of the replay against the recording's, and reports the timings. Returns
+	the exit status - EXIT_FAILURE if the replay diverged.
+*/
+{
+	int status = EXIT_SUCCESS;
+	fflush( stdout );
+	switch ( Replay.mode ) {
+	case NoReplay:
+		break;
+	case Recording:
+		record_line();
+		fprintf( Replay.record, "= %ld %016lx\n", Replay.output.bytes, Replay.output.hash );
+		fclose( Replay.record );
+		break;
+	case Replaying:
+		if ( Replay.timing.on ) time_line();
+		long elapsed = now() - Replay.timing.start;
+		long length; char *identifier, *bytes; int n;
+		int kind;
+		while (( kind = next_block( &length, &identifier, &n, &bytes )) && ( kind != '=' ))
+			diverge( "input left unread" );
+		if ( Replay.block.remaining > 0 )
+			diverge( "input left unread" );
+		if ( Replay.timing.on ) {
+			output_timing( elapsed );
+			region_free( &Replay.timing.latency );
+		}
+		if ( kind != '=' )
+			fprintf( stderr, "replay: output %ld bytes, hash %016lx - not recorded\n",
+				Replay.output.bytes, Replay.output.hash );
+		else if (( length == Replay.output.bytes ) && ( strtoul( identifier, NULL, 16 ) == Replay.output.hash )) {
+			if ( Replay.timing.on )
+				fprintf( stderr, "replay: output %ld bytes, hash %016lx - same as recorded\n",
+					Replay.output.bytes, Replay.output.hash );
+		}
+		else {
+			fprintf( stderr, "replay: output %ld bytes, hash %016lx - recorded %ld bytes, hash %.*s\n",
+				Replay.output.bytes, Replay.output.hash, length, n, identifier );
+			status = EXIT_FAILURE;
+		}
+		if ( Replay.diverged ) status = EXIT_FAILURE;
+		region_free( &Replay.file.region );
+		break;
+	}
+	Replay.mode = NoReplay;
+	return status;
+}
@@ -0,0 +1,15 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+/*---------------------------------------------------------------------------
+	replay utilities	- public
+---------------------------------------------------------------------------*/
+
+int	replayRecord( char *path );
+int	replayOpen( char *path, int timing );
+int	replayGetchar( void );
+int	replayStream( char *identifier, InputType type, FILE **file );
+int	replayEnd( void );
+
+
+#endif	// REPLAY_H
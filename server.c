@@ -0,0 +1,409 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "database.h"
+#include "registry.h"
+#include "kernel.h"
+
+#include "api.h"
+#include "input.h"
+#include "output.h"
+#include "variables.h"
+#include "server.h"
+
+// #define DEBUG
+
+/*---------------------------------------------------------------------------
+	sessions
+---------------------------------------------------------------------------*/
+typedef struct {
+	int fd;
+	struct {
+		char *ptr;
+		size_t len, position;
+		unsigned int eof : 1;
+	} in;
+	struct {
+		FILE *stream;	// stdout and stderr while the session is current
+		char *ptr;
+		size_t len, sent;
+	} out;
+	registryEntry *variables;
+} Session;
+
+static struct {
+	int fd;
+	char *path;
+	listItem *sessions;	// { session }
+	Session *current;
+	registryEntry *variables;	// console's, while a session is current
+	int last_event;
+	FILE *stdout, *stderr;
+} Server = { -1 };
+
+static Session *
+new_session( int fd )
+{
+	Session *session = (Session *) calloc( 1, sizeof(Session) );
+	session->fd = fd;
+	session->out.stream = open_memstream( &session->out.ptr, &session->out.len );
+	set_this_variable( &session->variables, CN.this );
+	return session;
+}
+
+static void
+free_session( Session *session )
+{
+	freeOutputQueries( session->out.stream );
+	close( session->fd );
+	fclose( session->out.stream );
+	free( session->out.ptr );
+	free( session->in.ptr );
+	freeVariables( &session->variables );
+	free( session );
+}
+
+/*---------------------------------------------------------------------------
+	session input
+---------------------------------------------------------------------------*/
+static int
+session_read( Session *session )
+/*
+	appends whatever is available on the session's socket to its input
+	buffer. Returns 0 upon EOF or error, 1 otherwise.
+*/
+{
+	char buffer[ 4096 ];
+	for ( ; ; ) {
+		ssize_t n = recv( session->fd, buffer, sizeof(buffer), 0 );
+		if ( n > 0 ) {
+			size_t len = session->in.len - session->in.position;
+			char *ptr = (char *) malloc( len + n + 1 );
+			memcpy( ptr, session->in.ptr + session->in.position, len );
+			memcpy( ptr + len, buffer, n );
+			free( session->in.ptr );
+			session->in.ptr = ptr;
+			session->in.len = len + n;
+			session->in.position = 0;
+		}
+		else if (( n < 0 ) && (( errno == EAGAIN ) || ( errno == EWOULDBLOCK )))
+			return 1;
+		else if (( n < 0 ) && ( errno == EINTR ))
+			continue;
+		else break;
+	}
+	// terminate last command if needed
+	if (( session->in.len > 0 ) && ( session->in.ptr[ session->in.len - 1 ] != '\n' )) {
+		session->in.ptr[ session->in.len++ ] = '\n';
+	}
+	session->in.eof = 1;
+	return 0;
+}
+
+static int
+session_has_command( Session *session )
+{
+	return ( memchr( session->in.ptr + session->in.position, '\n',
+		session->in.len - session->in.position ) != NULL );
+}
+
+/*---------------------------------------------------------------------------
+	session output
+---------------------------------------------------------------------------*/
+static void
+session_write( Session *session )
+/*
+	sends as much of the session's pending output as the socket accepts
+	without blocking
+*/
+{
+	fflush( session->out.stream );
+	while ( session->out.sent < session->out.len ) {
+		ssize_t n = send( session->fd, session->out.ptr + session->out.sent,
+			session->out.len - session->out.sent, MSG_NOSIGNAL );
+		if ( n > 0 )
+			session->out.sent += n;
+		else if (( n < 0 ) && ( errno == EINTR ))
+			continue;
+		else if (( n < 0 ) && (( errno == EAGAIN ) || ( errno == EWOULDBLOCK )))
+			return;
+		else {
+			// peer is gone: discard output
+			session->out.sent = session->out.len;
+			session->in.eof = 1;
+		}
+	}
+	if ( session->out.len > 0 ) {
+		fseeko( session->out.stream, 0, SEEK_SET );
+		session->out.len = session->out.sent = 0;
+	}
+}
+
+static int
+session_done( Session *session )
+{
+	return ( session->in.eof && ( session->in.position == session->in.len ) &&
+		( session->out.sent == session->out.len ) && ( session != Server.current ));
+}
+
+/*---------------------------------------------------------------------------
+	set_current_session
+---------------------------------------------------------------------------*/
+static void
+set_current_session( Session *session, _context *context )
+/*
+	sessions only ever get switched at command boundaries, where the
+	control stack is down to its base level
+*/
+{
+	if ( session == Server.current )
+		return;
+
+	StackVA *stack = (StackVA *) context->control.stack->ptr;
+	if ( Server.current != NULL ) {
+		session_write( Server.current );
+		Server.current->variables = stack->variables;
+	}
+	else {
+		fflush( stdout );
+		fflush( stderr );
+		Server.variables = stack->variables;
+	}
+	Server.current = session;
+	stack->variables = session->variables;
+	session->variables = NULL;
+	stdout = stderr = session->out.stream;
+}
+
+static void
+release_current_session( _context *context )
+{
+	Session *session = Server.current;
+	StackVA *stack = (StackVA *) context->control.stack->ptr;
+	session_write( session );
+	session->variables = stack->variables;
+	stack->variables = Server.variables;
+	Server.current = NULL;
+	stdout = Server.stdout;
+	stderr = Server.stderr;
+}
+
+/*---------------------------------------------------------------------------
+	server_accept
+---------------------------------------------------------------------------*/
+static void
+server_accept( void )
+{
+	for ( ; ; ) {
+		int fd = accept( Server.fd, NULL, NULL );
+		if ( fd < 0 ) return;
+		fcntl( fd, F_SETFL, fcntl( fd, F_GETFL ) | O_NONBLOCK );
+		addItem( &Server.sessions, new_session( fd ) );
+#ifdef DEBUG
+		fprintf( Server.stderr, "debug> server: session %d opened\n", fd );
+#endif
+	}
+}
+
+/*---------------------------------------------------------------------------
+	server_flush, server_reap
+---------------------------------------------------------------------------*/
+static void
+server_flush( void )
+{
+	// sessions may be sent output while not current - e.g. query deltas
+	for ( listItem *i = Server.sessions; i!=NULL; i=i->next )
+		session_write( (Session *) i->ptr );
+}
+
+static void
+server_reap( void )
+{
+	listItem *next_i;
+	for ( listItem *i = Server.sessions; i!=NULL; i=next_i ) {
+		next_i = i->next;
+		Session *session = (Session *) i->ptr;
+		if ( session_done( session ) ) {
+#ifdef DEBUG
+			fprintf( Server.stderr, "debug> server: session %d closed\n", session->fd );
+#endif
+			removeItem( &Server.sessions, session );
+			free_session( session );
+		}
+	}
+}
+
+/*---------------------------------------------------------------------------
+	server_poll
+---------------------------------------------------------------------------*/
+static void
+server_poll( void )
+/*
+	waits for new connections, input or output readiness
+*/
+{
+	server_flush();
+	server_reap();
+
+	int count = 1;
+	for ( listItem *i = Server.sessions; i!=NULL; i=i->next ) count++;
+	struct pollfd *fds = (struct pollfd *) calloc( count, sizeof(struct pollfd) );
+	fds[ 0 ].fd = Server.fd;
+	fds[ 0 ].events = POLLIN;
+	count = 1;
+	for ( listItem *i = Server.sessions; i!=NULL; i=i->next, count++ ) {
+		Session *session = (Session *) i->ptr;
+		fds[ count ].fd = session->fd;
+		if ( !session->in.eof ) fds[ count ].events |= POLLIN;
+		if ( session->out.sent < session->out.len ) fds[ count ].events |= POLLOUT;
+	}
+	while (( poll( fds, count, -1 ) < 0 ) && ( errno == EINTR ));
+
+	count = 1;
+	for ( listItem *i = Server.sessions; i!=NULL; i=i->next, count++ ) {
+		Session *session = (Session *) i->ptr;
+		if (( fds[ count ].revents & ( POLLIN | POLLHUP | POLLERR )) && !session->in.eof )
+			session_read( session );
+		if ( fds[ count ].revents & POLLOUT )
+			session_write( session );
+	}
+	if ( fds[ 0 ].revents & POLLIN )
+		server_accept();
+
+	free( fds );
+}
+
+/*---------------------------------------------------------------------------
+	server_getc
+---------------------------------------------------------------------------*/
+int
+server_getc( char *state, _context *context )
+/*
+	replaces getchar() in server mode. Input is served one session at a
+	time: the current session keeps the engine until it is back at base
+	level after a complete command, whereupon the next session holding a
+	complete command gets its turn - round-robin.
+*/
+{
+	Session *session = Server.current;
+	int boundary = ( Server.last_event == '\n' ) && !strcmp( state, base ) &&
+		( context->control.level == 0 );
+
+	for ( ; ; ) {
+		if ( session != NULL ) {
+			if ( session->in.position < session->in.len ) {
+				if ( !boundary || session_has_command( session ) ) {
+					if (( session->out.len > 0 ) || boundary )
+						session_write( session );
+					Server.last_event = session->in.ptr[ session->in.position++ ];
+					return Server.last_event;
+				}
+			}
+			else if ( session->in.eof && !boundary ) {
+				// session closed in the middle of an instruction block
+				raise_error( context, 0, "session closed - restoring original stack level" );
+				char *next_state = base;
+				while ( context->control.level > 0 )
+					pop( state, 0, &next_state, context );
+				freeInstructionBlock( context );
+				set_control_mode( ExecutionMode, 0, context );
+				Server.last_event = '\n';
+				return Server.last_event;
+			}
+		}
+		if ( boundary ) {
+			server_flush();
+
+			// round-robin to the next session holding a complete command
+			listItem *start = ( session == NULL ) ? NULL : lookupItem( Server.sessions, session );
+			listItem *i = ( start == NULL ) ? Server.sessions : start->next;
+			Session *next = NULL;
+			for ( int n=0; ( next == NULL ) && ( n < 2 ); n++ ) {
+				for ( ; i!=NULL; i=i->next ) {
+					Session *candidate = (Session *) i->ptr;
+					if ( session_has_command( candidate ) ) {
+						next = candidate;
+						break;
+					}
+					if ( i == start ) break;
+				}
+				i = Server.sessions;
+			}
+			if ( next != NULL ) {
+				set_current_session( next, context );
+				session = next;
+				continue;
+			}
+			if ( session != NULL ) {
+				release_current_session( context );
+				session = NULL;
+			}
+		}
+		server_poll();
+	}
+}
+
+/*---------------------------------------------------------------------------
+	server_init
+---------------------------------------------------------------------------*/
+int
+server_init( char *address, _context *context )
+/*
+	address is either a TCP port number, in which case the server listens
+	on the loopback interface, or the path of a Unix domain socket.
+	Returns -1 on failure.
+*/
+{
+	if ( strspn( address, "0123456789" ) == strlen( address ) ) {
+		struct sockaddr_in addr;
+		memset( &addr, 0, sizeof(addr) );
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons( atoi( address ) );
+		addr.sin_addr.s_addr = htonl( INADDR_LOOPBACK );
+		Server.fd = socket( AF_INET, SOCK_STREAM, 0 );
+		int on = 1;
+		setsockopt( Server.fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+		if (( Server.fd < 0 ) || bind( Server.fd, (struct sockaddr *) &addr, sizeof(addr) ) < 0 ) {
+			perror( "consensus> server" );
+			return -1;
+		}
+	}
+	else {
+		struct sockaddr_un addr;
+		memset( &addr, 0, sizeof(addr) );
+		addr.sun_family = AF_UNIX;
+		if ( strlen( address ) >= sizeof(addr.sun_path) ) {
+			fprintf( stderr, "consensus> server: socket path too long\n" );
+			return -1;
+		}
+		strcpy( addr.sun_path, address );
+		unlink( address );
+		Server.fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if (( Server.fd < 0 ) || bind( Server.fd, (struct sockaddr *) &addr, sizeof(addr) ) < 0 ) {
+			perror( "consensus> server" );
+			return -1;
+		}
+		Server.path = strdup( address );
+	}
+	if ( listen( Server.fd, SOMAXCONN ) < 0 ) {
+		perror( "consensus> server" );
+		return -1;
+	}
+	fcntl( Server.fd, F_SETFL, fcntl( Server.fd, F_GETFL ) | O_NONBLOCK );
+
+	Server.stdout = stdout;
+	Server.stderr = stderr;
+	Server.last_event = '\n';
+	context->input.server = 1;
+	context->control.prompt = 0;
+	return 0;
+}
@@ -0,0 +1,12 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+/*---------------------------------------------------------------------------
+	server utilities	- public
+---------------------------------------------------------------------------*/
+
+int	server_init( char *address, _context *context );
+int	server_getc( char *state, _context *context );
+
+
+#endif	// SERVER_H
@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+// #define DEBUG
+
+/*---------------------------------------------------------------------------
+	slabs
+---------------------------------------------------------------------------*/
+/*
+	A slab is a SLAB_SIZE block mapped from the OS, aligned on SLAB_SIZE so
+	that the slab of any object is found by masking the object's address.
+	Objects are handed out first from the slab's own free list, then from
+	its never used remainder - fresh objects thus come zeroed, as calloc'd.
+	Freed objects are chained through their first word.
+	Each pool keeps its slabs holding free objects in two lists: available
+	- partly occupied - and empty. Full slabs are in neither. Empty slabs
+	are only given back to the OS by slabCompact(), so that freed objects
+	remain readable until their pool is compacted.
+*/
+struct _Slab {
+	struct _Slab *prev, *next;
+	void *free;		// freed objects
+	char *unused;		// objects never handed out
+	long live;		// objects in use
+	long capacity;
+};
+
+#define SLAB_HEADER	(( sizeof( Slab ) + 15 ) & ~15 )
+#define slab_of( object )	((Slab *) ((uintptr_t) ( object ) & ~((uintptr_t) SLAB_SIZE - 1 )))
+
+static void
+slab_link( Slab **list, Slab *slab )
+{
+	slab->prev = NULL;
+	slab->next = *list;
+	if ( *list != NULL ) (*list)->prev = slab;
+	*list = slab;
+}
+
+static void
+slab_unlink( Slab **list, Slab *slab )
+{
+	if ( slab->prev == NULL ) *list = slab->next;
+	else slab->prev->next = slab->next;
+	if ( slab->next != NULL ) slab->next->prev = slab->prev;
+	slab->prev = slab->next = NULL;
+}
+
+static Slab *
+slab_map( SlabPool *pool )
+/*
+	mmap does not guarantee any alignment beyond the page size, so we map
+	twice the size needed, and unmap whatever lies outside the aligned slab
+*/
+{
+	char *p = mmap( NULL, 2 * SLAB_SIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0 );
+	if ( p == MAP_FAILED ) return NULL;
+	char *slab_p = (char *) slab_of( p + SLAB_SIZE - 1 );
+	if ( slab_p > p ) munmap( p, slab_p - p );
+	munmap( slab_p + SLAB_SIZE, p + SLAB_SIZE - slab_p );
+
+	Slab *slab = (Slab *) slab_p;
+	slab->unused = slab_p + SLAB_HEADER;
+	slab->capacity = ( SLAB_SIZE - SLAB_HEADER ) / pool->size;
+	pool->slabs++;
+#ifdef DEBUG
+	fprintf( stderr, "debug> slab_map: %p - %ld slabs of %ld-byte objects\n", slab, pool->slabs, pool->size );
+#endif
+	return slab;
+}
+
+/*---------------------------------------------------------------------------
+	slabAlloc, slabFree
+---------------------------------------------------------------------------*/
+void *
+slabAlloc( SlabPool *pool )
+/*
+	returns NULL if the OS refused to map a new slab
+*/
+{
+	Slab *slab = pool->available;
+	if ( slab == NULL ) {
+		if ( pool->empty != NULL ) {
+			slab = pool->empty;
+			slab_unlink( &pool->empty, slab );
+			pool->empties--;
+		}
+		else if (( slab = slab_map( pool ) ) == NULL )
+			return NULL;
+		slab_link( &pool->available, slab );
+	}
+	void *object;
+	if ( slab->free != NULL ) {
+		object = slab->free;
+		slab->free = *(void **) object;
+	}
+	else {
+		object = slab->unused;
+		slab->unused += pool->size;
+	}
+	if ( ++slab->live == slab->capacity )
+		slab_unlink( &pool->available, slab );
+	if ( ++pool->live > pool->peak )
+		pool->peak = pool->live;
+	return object;
+}
+
+void
+slabFree( SlabPool *pool, void *object )
+{
+	Slab *slab = slab_of( object );
+	*(void **) object = slab->free;
+	slab->free = object;
+	if ( slab->live-- == slab->capacity )
+		slab_link( &pool->available, slab );
+	if ( slab->live == 0 ) {
+		slab_unlink( &pool->available, slab );
+		slab_link( &pool->empty, slab );
+		pool->empties++;
+	}
+	pool->live--;
+}
+
+/*---------------------------------------------------------------------------
+	slabCompact
+---------------------------------------------------------------------------*/
+long
+slabCompact( SlabPool *pool, long keep )
+/*
+	gives the pool's empty slabs back to the OS, but for keep of them.
+	Returns the number of bytes released.
+*/
+{
+	long released = 0;
+	while ( pool->empties > keep ) {
+		Slab *slab = pool->empty;
+		slab_unlink( &pool->empty, slab );
+		munmap( slab, SLAB_SIZE );
+		pool->empties--;
+		pool->slabs--;
+		released += SLAB_SIZE;
+	}
+#ifdef DEBUG
+	if ( released ) fprintf( stderr, "debug> slabCompact: %ld bytes released\n", released );
+#endif
+	return released;
+}
+
+/*---------------------------------------------------------------------------
+	slabStats
+---------------------------------------------------------------------------*/
+void
+slabStats( SlabPool *pool, PoolStats *stats )
+{
+	long capacity = ( SLAB_SIZE - SLAB_HEADER ) / pool->size;
+	stats->live = pool->live;
+	stats->free = pool->slabs * capacity - pool->live;
+	stats->peak = pool->peak;
+	stats->size = pool->size;
+	stats->slabs = pool->slabs;
+	stats->empty = pool->empties;
+}
@@ -0,0 +1,30 @@
+#ifndef SLAB_H
+#define SLAB_H
+#include "registry.h"
+
+/*---------------------------------------------------------------------------
+	slab utilities		- public
+---------------------------------------------------------------------------*/
+
+#define SLAB_SIZE	( 64 * 1024 )	// bytes mapped per slab - also their alignment
+
+typedef struct _Slab Slab;	// see slab.c
+
+typedef struct {
+	long size;		// bytes per object
+	Slab *available;	// slabs holding both live and free objects
+	Slab *empty;		// slabs holding no live object
+	long slabs, empties;	// slabs mapped, and how many of these are empty
+	long live, peak;	// objects in use, and highest number thereof
+}
+SlabPool;
+
+#define SLAB_POOL( type )	{ sizeof( type ), NULL, NULL, 0, 0, 0, 0 }
+
+void	*slabAlloc( SlabPool *pool );
+void	slabFree( SlabPool *pool, void *object );
+long	slabCompact( SlabPool *pool, long keep );
+void	slabStats( SlabPool *pool, PoolStats *stats );
+
+
+#endif	// SLAB_H
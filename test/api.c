@@ -0,0 +1,82 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "registry.h"
+#include "kernel.h"
+
+#include "api.h"
+
+/*---------------------------------------------------------------------------
+	api	- cn_parse(), cn_query() and cn_cursor() test
+---------------------------------------------------------------------------*/
+/*
+	Builds the relations a-is->b, c-is->b and a-has->c, then
+	checks that the results of each of the API's query paths agree.
+*/
+static int failed = 0;
+
+#define check( condition ) \
+	if ( !( condition ) ) { fprintf( stderr, "api: %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); failed++; }
+
+static int
+holds( Entity **results, Entity *e )
+{
+	for ( Entity **r = results; ( r != NULL ) && ( *r != NULL ); r++ )
+		if ( *r == e ) return 1;
+	return 0;
+}
+
+int
+main( int argc, char *argv[] )
+{
+	check( cn_init() );
+	Entity *a = cn_new( strdup( "a" ) );
+	Entity *b = cn_new( strdup( "b" ) );
+	Entity *c = cn_new( strdup( "c" ) );
+	Entity *is = cn_new( strdup( "is" ) );
+	Entity *has = cn_new( strdup( "has" ) );
+	Entity *ab = cn_instantiate( a, is, b );
+	Entity *cb = cn_instantiate( c, is, b );
+	cn_instantiate( a, has, c );
+	cn_frame();
+	check( cn_entity( "a" ) == a );
+
+	// cn_query
+	int count;
+	Entity **results = cn_query( ".-is->b", &count );
+	check( count == 2 );
+	check( holds( results, ab ) && holds( results, cb ) );
+	free( results );
+
+	results = cn_query( "?-has->c", &count );
+	check(( count == 1 ) && ( results != NULL ) && ( results[ 0 ] == a ));
+	free( results );
+
+	results = cn_query( ".-has->b", &count );
+	check(( count == 0 ) && ( results == NULL ));
+
+	// cn_parse, solved any number of times
+	check( cn_parse( "a-is-(" ) == NULL );	// reports the error
+	Expression *expression = cn_parse( "?-is->b" );
+	check( expression != NULL );
+	for ( int n=0; n<2; n++ ) {
+		results = cn_solve( expression, &count );
+		check(( count == 2 ) && holds( results, a ) && holds( results, c ));
+		free( results );
+	}
+
+	// cn_cursor, yielding the same results
+	Cursor *cursor = cn_cursor( expression );
+	check( cursor != NULL );
+	int yielded = 0;
+	for ( Entity *e; ( e = cn_next( cursor ) ) != NULL; yielded++ )
+		check(( e == a ) || ( e == c ));
+	check( yielded == 2 );
+	check( cn_next( cursor ) == NULL );
+	cn_close( cursor );
+	cn_free_expression( expression );
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,130 @@
+#define _GNU_SOURCE	// asprintf
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "registry.h"
+#include "kernel.h"
+
+#include "api.h"
+#include "command.h"
+#include "input.h"
+
+/*---------------------------------------------------------------------------
+	native	- cn_register_native() and cn_deregister_native() test
+---------------------------------------------------------------------------*/
+/*
+	Runs a story whose commands and narrative invoke the native action
+	probe() with %variable, %? and %% arguments, which probe() logs as
+		probe( name, ... )
+	one parenthesized list of entity names per argument. The story then
+	invokes an unknown native, passes an unset variable, and finally
+	invokes probe() once deregistered - each of which must raise an error
+	without invoking anything.
+*/
+static int failed = 0;
+
+#define check( condition ) \
+	if ( !( condition ) ) { fprintf( stderr, "native: %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); failed++; }
+
+static char *story[] = {
+	"!! titi-is->toto\n",
+	"!! tata-is->toto\n",
+	": x : %[ ?-is->toto ]\n",
+	"!> probe( %x )\n",
+	"?: ?-is->toto\n\t!> probe( %?, %x )\n\t/\n",
+	"!! %[ titi ].n()\n\ton e: ?-is->go !! do\n\t\t!> probe( %%, %e )\n\t\t/.\n\t/\n",
+	"!* %[ titi ].n()\n",
+	"!! tutu-is->go\n",
+	"!> unknown( %x )\n",
+	"!> probe( %y )\n",
+	NULL
+};
+
+static char *expected =
+	"probe( ( tata, titi ) )\n"
+	"probe( ( titi ), ( tata, titi ) )\n"
+	"probe( ( tata ), ( tata, titi ) )\n"
+	"probe( ( titi ), ( tutu ) )\n";
+
+static char *Log = NULL;
+
+static void
+log_string( char *string )
+{
+	char *log;
+	asprintf( &log, "%s%s", ( Log == NULL ) ? "" : Log, string );
+	free( Log );
+	Log = log;
+}
+
+static int
+compare_names( const void *a, const void *b )
+{
+	return strcmp( *(char **) a, *(char **) b );
+}
+
+static int
+probe( int argc, Entity **argv[], void *user_data )
+/*
+	logs each argument's entity names in alphabetical order - the order
+	in which entities are passed is not part of the interface
+*/
+{
+	(*(int *) user_data)++;
+	log_string( "probe(" );
+	for ( int i=0; i<argc; i++ ) {
+		char *names[ 16 ];
+		int n = 0;
+		for ( Entity **e = argv[ i ]; ( *e != NULL ) && ( n < 16 ); e++ )
+			names[ n++ ] = cn_name( *e );
+		qsort( names, n, sizeof(char *), compare_names );
+		log_string( i ? ", (" : " (" );
+		for ( int j=0; j<n; j++ ) {
+			log_string( j ? ", " : " " );
+			log_string( names[ j ] );
+		}
+		log_string( " )" );
+	}
+	log_string( " )\n" );
+	return 0;
+}
+
+static void
+run( char *commands[] )
+/*
+	reads commands to the end of input - which each run starts anew
+*/
+{
+	CN.context->input.eof = 0;
+	for ( int i=0; commands[ i ]!=NULL; i++ )
+		queue_input( NULL, strdup( commands[ i ] ), CN.context );
+	read_command( base, 0, &same, CN.context );
+}
+
+int
+main( int argc, char *argv[] )
+{
+	int calls = 0;
+	cn_init();
+	CN.context->control.quiet = 1;
+	CN.context->input.headless = 1;
+	check( cn_register_native( "probe", NULL, &calls ) == 0 );
+	check( cn_register_native( "probe", probe, &calls ) == 1 );
+
+	run( story );
+	check( calls == 4 );
+	check(( Log != NULL ) && !strcmp( Log, expected ));
+	check( CN.context->error.count == 2 );
+
+	check( cn_deregister_native( "probe" ) == 1 );
+	check( cn_deregister_native( "probe" ) == 0 );
+	char *deregistered[] = { "!> probe( %x )\n", NULL };
+	run( deregistered );
+	check( calls == 4 );
+	check( CN.context->error.count == 3 );
+
+	free( Log );
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+/*---------------------------------------------------------------------------
+	server	- --server test
+---------------------------------------------------------------------------*/
+/*
+	usage: test_server path/to/consensus
+
+	Starts the engine in server mode on a Unix socket, and connects two
+	clients which take turns sending several commands at once - pipelined.
+	Each client must get its own replies - errors included - and keep its
+	own variables, though both set the same variable name.
+*/
+static struct {
+	int client;
+	char *commands;
+	char *expected;
+} Exchange[] = {
+	{ 0, "!! a\n: v : %[ a ]\n>: A %v\n", " A a\n" },
+	{ 1, "!! b\n: v : %[ b ]\n>: B %v\n", " B b\n" },
+	{ 0, ">: A then %v\n", " A then a\n" },
+	{ 1, ":unknown\n>: B then %v\n", "***** Error: unknown directive ':unknown'\n B then b\n" },
+	{ -1, NULL, NULL }
+};
+
+static int
+connect_to( char *path )
+{
+	struct sockaddr_un addr;
+	memset( &addr, 0, sizeof(addr) );
+	addr.sun_family = AF_UNIX;
+	strcpy( addr.sun_path, path );
+	for ( int retry=0; retry<100; retry++ ) {
+		int fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+		if ( connect( fd, (struct sockaddr *) &addr, sizeof(addr) ) == 0 ) {
+			// a reply shorter than expected fails, rather than blocks
+			struct timeval timeout = { 5, 0 };
+			setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+			return fd;
+		}
+		close( fd );
+		usleep( 50000 );	// the server may not be listening yet
+	}
+	return -1;
+}
+
+static char *
+read_reply( int fd, size_t expected )
+/*
+	reads until the expected number of bytes came, or the server closed
+	the session, or the timeout expired
+*/
+{
+	size_t len = 0;
+	char *reply = (char *) malloc( expected + 1 );
+	ssize_t n;
+	while (( len < expected ) && (( n = read( fd, reply + len, expected - len ) ) > 0 ))
+		len += n;
+	reply[ len ] = '\0';
+	return reply;
+}
+
+int
+main( int argc, char *argv[] )
+{
+	if ( argc != 2 ) {
+		fprintf( stderr, "usage: %s path/to/consensus\n", argv[ 0 ] );
+		return 1;
+	}
+	char path[ 64 ];
+	snprintf( path, sizeof(path), "/tmp/consensus_server_test.%d", (int) getpid() );
+
+	pid_t server = fork();
+	if ( server == 0 ) {
+		execl( argv[ 1 ], argv[ 1 ], "-q", "--server", path, (char *) NULL );
+		perror( "server: exec" );
+		_exit( 1 );
+	}
+	int fd[ 2 ];
+	for ( int i=0; i<2; i++ )
+		fd[ i ] = connect_to( path );
+	int failed = ( fd[ 0 ] < 0 ) || ( fd[ 1 ] < 0 );
+	if ( failed )
+		fprintf( stderr, "server: could not connect to %s\n", path );
+	else for ( int i=0; Exchange[ i ].commands!=NULL; i++ ) {
+		int client = fd[ Exchange[ i ].client ];
+		char *expected = Exchange[ i ].expected;
+		write( client, Exchange[ i ].commands, strlen( Exchange[ i ].commands ) );
+		char *reply = read_reply( client, strlen( expected ) );
+		if ( strcmp( reply, expected ) ) {
+			fprintf( stderr, "server: client %d expected\n%sgot\n%s\n", Exchange[ i ].client, expected, reply );
+			failed = 1;
+		}
+		free( reply );
+	}
+	for ( int i=0; i<2; i++ )
+		if ( fd[ i ] >= 0 ) close( fd[ i ] );
+	kill( server, SIGTERM );
+	waitpid( server, NULL, 0 );
+	unlink( path );
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,79 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "database.h"
+#include "registry.h"
+#include "kernel.h"
+
+#include "api.h"
+
+/*---------------------------------------------------------------------------
+	subscribe	- cn_subscribe() and cn_unsubscribe() test
+---------------------------------------------------------------------------*/
+/*
+	Subscriptions are notified in the reverse order of their registration.
+	The first one notified unsubscribes the next one - which must then not
+	be notified - and eventually itself.
+*/
+static int failed = 0;
+
+#define check( condition ) \
+	if ( !( condition ) ) { fprintf( stderr, "subscribe: %s:%d: check failed: %s\n", __FILE__, __LINE__, #condition ); failed++; }
+
+typedef struct {
+	int calls;
+	Subscription *self, *other;	// unsubscribed by the callback
+}
+Subscriber;
+
+static void
+notify( EventType type, listItem *changes, void *user_data )
+{
+	Subscriber *subscriber = (Subscriber *) user_data;
+	subscriber->calls++;
+	if ( subscriber->other != NULL ) {
+		check( cn_unsubscribe( subscriber->other ) == 1 );
+		check( cn_unsubscribe( subscriber->other ) == 0 );
+		subscriber->other = NULL;
+	}
+	else if ( subscriber->self != NULL ) {
+		check( cn_unsubscribe( subscriber->self ) == 1 );
+		subscriber->self = NULL;
+	}
+}
+
+int
+main( int argc, char *argv[] )
+{
+	cn_init();
+	Subscriber first = { 0, NULL, NULL }, next = { 0, NULL, NULL };
+
+	check( cn_subscribe( 0, NULL, notify, &first ) == NULL );
+	check( cn_subscribe( DeactivateEvent + 1, NULL, notify, &first ) == NULL );
+	check( cn_subscribe( InstantiateEvent, NULL, NULL, &first ) == NULL );
+
+	Subscription *s = cn_subscribe( InstantiateEvent, NULL, notify, &next );
+	check( s != NULL );
+	first.other = s;
+	first.self = cn_subscribe( InstantiateEvent, NULL, notify, &first );
+	check( first.self != NULL );
+
+	cn_new( strdup( "a" ) );
+	cn_frame();
+	check( first.calls == 1 );
+	check( next.calls == 0 );
+	check( cn_unsubscribe( s ) == 0 );
+
+	cn_new( strdup( "b" ) );
+	cn_frame();
+	check( first.calls == 2 );
+	check( first.self == NULL );
+
+	cn_new( strdup( "c" ) );
+	cn_frame();
+	check( first.calls == 2 );
+	check( next.calls == 0 );
+
+	return failed ? 1 : 0;
+}
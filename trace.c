@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "trace.h"
+
+// #define DEBUG
+
+#define TRACE_BUFFER	4096	// events held in memory between writes
+
+/*---------------------------------------------------------------------------
+	trace
+---------------------------------------------------------------------------*/
+/*
+	Engine activity is traced as Chrome trace events - viewable in
+	chrome://tracing or Perfetto - each span being a complete ("X") event.
+	Spans are held in a fixed buffer, which is written out whenever full,
+	and upon closing. When not tracing, traceClock() returns 0, and callers
+	skip the rest. Spans are recorded from the worker threads as well, each
+	thread being numbered upon its first span - the "tid" of its events.
+*/
+typedef struct {
+	char *category, *name;	// static strings
+	char *detail;		// owned
+	long start, duration;	// in ns
+	int thread;
+}
+TraceEvent;
+
+static struct {
+	FILE *stream;
+	long origin;
+	int count, written;
+	int threads;	// numbered so far
+	pthread_mutex_t lock;
+	TraceEvent buffer[ TRACE_BUFFER ];
+} Trace = { NULL, 0, 0, 0, 0, PTHREAD_MUTEX_INITIALIZER };
+
+static __thread int TraceThread = 0;	// 0: not numbered yet
+
+static long
+clock_ns( void )
+{
+	struct timespec t;
+	clock_gettime( CLOCK_MONOTONIC, &t );
+	return t.tv_sec * 1000000000L + t.tv_nsec;
+}
+
+void
+traceString( FILE *stream, char *string )
+/*
+	writes string to stream as a JSON string
+*/
+{
+	fputc( '"', stream );
+	for ( char *p = string; *p; p++ ) {
+		switch ( *p ) {
+		case '"':	fputs( "\\\"", stream ); break;
+		case '\\':	fputs( "\\\\", stream ); break;
+		case '\n':	fputs( "\\n", stream ); break;
+		case '\t':	fputs( "\\t", stream ); break;
+		default:
+			if (( unsigned char ) *p < 0x20 )
+				fprintf( stream, "\\u%04x", *p );
+			else fputc( *p, stream );
+		}
+	}
+	fputc( '"', stream );
+}
+
+static void
+trace_flush( void )
+/*
+	writes out the buffered events - called with Trace.lock held
+*/
+{
+	int pid = getpid();
+	for ( int i=0; i<Trace.count; i++ ) {
+		TraceEvent *event = &Trace.buffer[ i ];
+		fprintf( Trace.stream, "%s\n{\"name\":", Trace.written++ ? "," : "" );
+		traceString( Trace.stream, event->name );
+		fprintf( Trace.stream, ",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+			event->category, ( event->start - Trace.origin ) / 1e3, event->duration / 1e3, pid, event->thread );
+		if ( event->detail != NULL ) {
+			fprintf( Trace.stream, ",\"args\":{\"detail\":" );
+			traceString( Trace.stream, event->detail );
+			fprintf( Trace.stream, "}" );
+			free( event->detail );
+		}
+		fprintf( Trace.stream, "}" );
+	}
+	Trace.count = 0;
+	fflush( Trace.stream );
+}
+
+/*---------------------------------------------------------------------------
+	traceOpen, traceClose
+---------------------------------------------------------------------------*/
+int
+traceOpen( char *path )
+/*
+	starts tracing into the file at path - closing the current trace if
+	there is one. Returns -1 if the file could not be opened.
+*/
+{
+	traceClose();
+	FILE *stream = fopen( path, "w" );
+	if ( stream == NULL )
+		return -1;
+
+	static int registered = 0;
+	if ( !registered ) {
+		atexit( traceClose );
+		registered = 1;
+	}
+	pthread_mutex_lock( &Trace.lock );
+	Trace.stream = stream;
+	Trace.origin = clock_ns();
+	Trace.written = 0;
+	fprintf( stream, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" );
+	pthread_mutex_unlock( &Trace.lock );
+#ifdef DEBUG
+	fprintf( stderr, "debug> traceOpen: %s\n", path );
+#endif
+	return 0;
+}
+
+void
+traceClose( void )
+{
+	pthread_mutex_lock( &Trace.lock );
+	if ( Trace.stream != NULL ) {
+		trace_flush();
+		fprintf( Trace.stream, "\n]}\n" );
+		fclose( Trace.stream );
+		Trace.stream = NULL;
+	}
+	pthread_mutex_unlock( &Trace.lock );
+}
+
+/*---------------------------------------------------------------------------
+	traceClock, traceSpan
+---------------------------------------------------------------------------*/
+long
+traceClock( void )
+/*
+	returns the current time in ns to be passed to traceSpan(), or 0 if not
+	tracing
+*/
+{
+	return ( Trace.stream == NULL ) ? 0 : clock_ns();
+}
+
+void
+traceSpan( char *category, char *name, long start, char *detail )
+/*
+	records a span from start - as returned by traceClock() - till now.
+	category and name must be static strings; detail, if any, is copied.
+*/
+{
+	if (( start == 0 ) || ( Trace.stream == NULL ))
+		return;
+	long end = clock_ns();
+	pthread_mutex_lock( &Trace.lock );
+	if ( Trace.stream != NULL ) {
+		if ( Trace.count == TRACE_BUFFER )
+			trace_flush();
+		TraceEvent *event = &Trace.buffer[ Trace.count++ ];
+		event->category = category;
+		event->name = name;
+		event->detail = ( detail == NULL ) ? NULL : strdup( detail );
+		event->start = start;
+		event->duration = end - start;
+		if ( TraceThread == 0 )
+			TraceThread = ++Trace.threads;
+		event->thread = TraceThread;
+	}
+	pthread_mutex_unlock( &Trace.lock );
+}
@@ -0,0 +1,15 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/*---------------------------------------------------------------------------
+	trace utilities		- public
+---------------------------------------------------------------------------*/
+
+int	traceOpen( char *path );
+void	traceClose( void );
+long	traceClock( void );
+void	traceSpan( char *category, char *name, long start, char *detail );
+void	traceString( FILE *stream, char *string );
+
+
+#endif	// TRACE_H
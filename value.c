@@ -8,6 +8,7 @@
 #include "string_util.h"
 
 #include "api.h"
+#include "frame.h"
 #include "narrative.h"
 #include "variables.h"
 #include "value.h"
@@ -71,6 +72,8 @@ set_va( char *state, int event, char **next_state, _context *context )
 #endif
 	if ( !context_check( 0, 0, ExecutionMode ) )
 		return 0;
+	if ( serialOnly( context ) )
+		return raise_error( context, event, NULL );
 
 	if ( context->expression.results == NULL )
 		return raise_error( context, event, "cannot assign value to (null) results" );
@@ -95,6 +98,8 @@ set_va_from_variable( char *state, int event, char **next_state, _context *conte
 #endif
 	if ( !context_check( 0, 0, ExecutionMode ) )
 		return 0;
+	if ( serialOnly( context ) )
+		return raise_error( context, event, NULL );
 
 	if ( context->expression.results == NULL )
 		return raise_error( context, event, "cannot assign value to (null) results" );
@@ -7,6 +7,7 @@
 #include "kernel.h"
 
 #include "api.h"
+#include "frame.h"
 #include "variables.h"
 #include "expression.h"
 #include "narrative.h"
@@ -81,6 +82,16 @@ lookupVariable( _context *context, char *identifier )
 	return entry;
 }
 
+static int
+serial_assignment( _context *context )
+/*
+	the narrative instance's own variables outlive its actions, and so
+	are only assigned serially - see serialOnly()
+*/
+{
+	return ( context->control.level < context->narrative.level ) && serialOnly( context );
+}
+
 /*---------------------------------------------------------------------------
 	assign_results
 ---------------------------------------------------------------------------*/
@@ -89,6 +100,8 @@ assign_results( char *state, int event, char **next_state, _context *context )
 {
 	if ( !context_check( 0, 0, ExecutionMode ) )
 		return 0;
+	if ( serial_assignment( context ) )
+		return raise_error( context, event, NULL );
 
 #ifdef DEBUG
 	fprintf( stderr, "debug> : %s : expression-results\n", context->identifier.id[ 0 ].ptr );
@@ -140,6 +153,8 @@ assign_va( char *state, int event, char **next_state, _context *context )
 {
 	if ( !context_check( 0, 0, ExecutionMode ) )
 		return 0;
+	if ( serial_assignment( context ) )
+		return raise_error( context, event, NULL );
 #ifdef DEBUG
 	fprintf( stderr, "debug> : %s : %%[_].$( %s )\n", context->identifier.id[ 0 ].ptr, context->identifier.id[ 2 ].ptr );
 #endif
@@ -195,6 +210,8 @@ assign_narrative( char *state, int event, char **next_state, _context *context )
 {
 	if ( !context_check( 0, 0, ExecutionMode ) )
 		return 0;
+	if ( serial_assignment( context ) )
+		return raise_error( context, event, NULL );
 
 #ifdef DEBUG
 	fprintf( stderr, "debug> : %s : %s()\n", context->identifier.id[ 0 ].ptr, context->identifier.id[ 1 ].ptr );
@@ -312,6 +329,8 @@ assign_expression( char *state, int event, char **next_state, _context *context
 {
 	if ( !context_check( 0, 0, ExecutionMode ) )
 		return 0;
+	if ( serial_assignment( context ) )
+		return raise_error( context, event, NULL );
 
 	Expression *expression = context->expression.ptr;
 	if ( expression == NULL ) {